@@ -0,0 +1,681 @@
+#include "aluminium.h"
+
+SDL_Renderer *renderer = nullptr;
+
+// Cxxdroid functions
+// Decodes an image into a 32-bit RGBA surface ready to be packed into the atlas
+static SDL_Surface *load_surface(const char *path)
+{
+    SDL_Surface *img = IMG_Load(path);
+    if (img == NULL)
+    {
+        fprintf(stderr, "IMG_Load Error: %s\n", IMG_GetError());
+        return NULL;
+    }
+    SDL_Surface *converted = SDL_ConvertSurfaceFormat(img, SDL_PIXELFORMAT_RGBA32, 0);
+    SDL_FreeSurface(img);
+    if (converted == NULL)
+    {
+        fprintf(stderr, "SDL_ConvertSurfaceFormat Error: %s\n", SDL_GetError());
+        return NULL;
+    }
+    return converted;
+}
+
+void Assets::decode() {
+    PROFILE_THREAD("decoder");
+    int i;
+    while (!cancelled && (i = nextJob.fetch_add(1)) < (int) jobs.size()) {
+        PROFILE_SCOPE("decode texture");
+        jobs[i].surface = load_surface(jobs[i].path.c_str());
+        decodedJobs++;
+    }
+};
+void Assets::begin_load(LoadStages stage) {
+    // Headless runs have nothing to upload textures to
+    if (renderer == nullptr) return;
+    if (startedStages & (1u << stage)) return;
+    startedStages |= 1u << stage;
+    
+    // Jobs can't be added while decoders are reading them
+    while (poll_load() < 1.0f) SDL_Delay(1);
+    
+    switch (stage) {
+         case TEXTURES:
+              add_texture("aluminium-ball", "aluminium-ball.png");
+              add_texture("wooden-ball", "wooden-ball.png");
+              add_texture("wooden-plank", "wooden-plank.png");
+              add_texture("wooden-beam", "wooden-beam.png");
+              break;
+    }
+    
+    start_decoders();
+};
+bool Assets::update_streaming() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (renderer == nullptr) {
+        pendingStream.clear();
+        return true;
+    }
+    if (poll_load() < 1.0f) return false;
+    if (pendingStream.empty()) return true;
+    
+    for (auto &handle : pendingStream) {
+        jobs.push_back({ handle, names[handle] + ".png", nullptr });
+    }
+    pendingStream.clear();
+    start_decoders();
+    return false;
+};
+float Assets::poll_load() {
+    if (jobs.empty()) return 1.0f;
+    
+    int decoded = decodedJobs;
+    if (decoded < (int) jobs.size()) {
+        return (float) decoded / (jobs.size() + 1);
+    }
+    for (auto &d : decoders) d.join();
+    decoders.clear();
+    
+    build_atlas();
+    jobs.clear();
+    return 1.0f;
+};
+void Assets::cancel_load() {
+    cancelled = true;
+    for (auto &d : decoders) d.join();
+    decoders.clear();
+    
+    for (auto &job : jobs) {
+        if (job.surface != NULL) SDL_FreeSurface(job.surface);
+    }
+    jobs.clear();
+};
+// Packs every decoded image into one texture with a shelf packer, tallest images first
+void Assets::build_atlas() {
+    const int padding = 1;
+    std::vector<DecodeJob*> images;
+    for (auto &job : jobs) {
+        if (job.surface != NULL) images.push_back(&job);
+    }
+    std::sort(images.begin(), images.end(), [](const DecodeJob *a, const DecodeJob *b) {
+        return a->surface->h > b->surface->h;
+    });
+    
+    int width = 256;
+    for (auto &image : images) {
+        while (width < image->surface->w + padding * 2) width <<= 1;
+    }
+    
+    // Place the white texels first, then every image left to right on shelves
+    std::vector<SDL_Rect> placed;
+    int x = padding + 2 + padding, y = padding, shelfHeight = 2;
+    for (auto &image : images) {
+        SDL_Surface *img = image->surface;
+        if (x + img->w + padding > width) {
+            x = padding;
+            y += shelfHeight + padding;
+            shelfHeight = 0;
+        }
+        placed.push_back({ x, y, img->w, img->h });
+        x += img->w + padding;
+        shelfHeight = std::max(shelfHeight, img->h);
+    }
+    int height = 1;
+    while (height < y + shelfHeight + padding) height <<= 1;
+    
+    SDL_Texture *atlas = nullptr;
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_RGBA32);
+    if (surface == NULL) {
+        fprintf(stderr, "SDL_CreateRGBSurfaceWithFormat Error: %s\n", SDL_GetError());
+    } else {
+        SDL_Rect whiteRect = { padding, padding, 2, 2 };
+        SDL_FillRect(surface, &whiteRect, SDL_MapRGBA(surface->format, 255, 255, 255, 255));
+        for (size_t i = 0; i < images.size(); i++) {
+            // Copy alpha as-is instead of blending onto the empty atlas
+            SDL_SetSurfaceBlendMode(images[i]->surface, SDL_BLENDMODE_NONE);
+            SDL_BlitSurface(images[i]->surface, NULL, surface, &placed[i]);
+        }
+        
+        atlas = SDL_CreateTextureFromSurface(renderer, surface);
+        SDL_FreeSurface(surface);
+        if (atlas == NULL) {
+            fprintf(stderr, "SDL_CreateTextureFromSurface Error: %s\n", SDL_GetError());
+        }
+    }
+    
+    if (atlas != nullptr) {
+        SDL_SetTextureBlendMode(atlas, SDL_BLENDMODE_BLEND);
+        atlases.push_back(atlas);
+        
+        auto region = [&](Sprite &sprite, SDL_Rect r) {
+            sprite.texture = atlas;
+            sprite.source = r;
+            sprite.u0 = (float) r.x / width;
+            sprite.v0 = (float) r.y / height;
+            sprite.u1 = (float) (r.x + r.w) / width;
+            sprite.v1 = (float) (r.y + r.h) / height;
+        };
+        // Sample the middle of the white block so filtering never reaches the padding
+        if (white.texture == nullptr) {
+            region(white, { padding, padding, 2, 2 });
+            white.u0 = white.u1 = (padding + 1.0f) / width;
+            white.v0 = white.v1 = (padding + 1.0f) / height;
+        }
+        for (size_t i = 0; i < images.size(); i++) {
+            region(sprites[images[i]->handle], placed[i]);
+        }
+    }
+    for (auto &image : images) {
+        SDL_FreeSurface(image->surface);
+    }
+};
+
+#if !defined(ALUMINIUM_NO_PROFILE)
+namespace Profiler {
+    // Buffers live until exit so events outlive the threads that recorded them
+    std::mutex buffersMutex;
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+    
+    void set_enabled(bool enabled) {
+        recording = enabled;
+    }
+    struct Registration {
+        ThreadBuffer *buffer = nullptr;
+        const char *threadName = "thread";
+        ~Registration() {
+            if (buffer == nullptr) return;
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffer->released = true;
+        }
+    };
+    thread_local Registration registration;
+    
+    // Short-lived threads like texture decoders take over the buffer of one that exited
+    // instead of growing the list
+    ThreadBuffer &thread_buffer() {
+        if (registration.buffer == nullptr) {
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            for (auto &b : buffers) {
+                if (!b->released) continue;
+                b->released = false;
+                registration.buffer = b.get();
+                break;
+            }
+            if (registration.buffer == nullptr) {
+                buffers.emplace_back(new ThreadBuffer(buffers.size()));
+                registration.buffer = buffers.back().get();
+            }
+            registration.buffer->threadName = registration.threadName;
+        }
+        return *registration.buffer;
+    }
+    void name_thread(const char *name) {
+        registration.threadName = name;
+        if (registration.buffer != nullptr) registration.buffer->threadName = name;
+    }
+    void counter(const char *name, float value) {
+        if (!enabled()) return;
+        Uint64 now = SDL_GetPerformanceCounter();
+        thread_buffer().push({ name, now, now, true, value });
+    }
+    
+    bool export_trace(const char *path) {
+        FILE *file = fopen(path, "w");
+        if (file == nullptr) {
+            fprintf(stderr, "Profiler Error: couldn't open %s for writing\n", path);
+            return false;
+        }
+        double toUs = 1e6 / SDL_GetPerformanceFrequency();
+        // Timestamps are relative to the earliest event still buffered
+        Uint64 origin = ~0ull;
+        std::lock_guard<std::mutex> lock(buffersMutex);
+        for (auto &b : buffers) {
+            unsigned int head = b->head.load(std::memory_order_acquire);
+            unsigned int count = std::min<unsigned int>(head, ThreadBuffer::CAPACITY);
+            for (unsigned int i = head - count; i != head; i++) origin = std::min(origin, b->events[i % ThreadBuffer::CAPACITY].start);
+        }
+        
+        fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+        bool first = true;
+        for (auto &b : buffers) {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s %d\"}}",
+                    first ? "" : ",\n", b->id, b->threadName, b->id);
+            first = false;
+            
+            unsigned int head = b->head.load(std::memory_order_acquire);
+            unsigned int count = std::min<unsigned int>(head, ThreadBuffer::CAPACITY);
+            for (unsigned int i = head - count; i != head; i++) {
+                const Event &e = b->events[i % ThreadBuffer::CAPACITY];
+                double ts = (e.start - origin) * toUs;
+                if (e.counter) {
+                    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"C\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d, \"args\": {\"value\": %.3f}}",
+                            e.name, ts, b->id, e.value);
+                } else {
+                    fprintf(file, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}",
+                            e.name, ts, (e.end - e.start) * toUs, b->id);
+                }
+            }
+        }
+        fprintf(file, "\n]}\n");
+        bool written = !ferror(file);
+        fclose(file);
+        if (!written) fprintf(stderr, "Profiler Error: couldn't write %s\n", path);
+        return written;
+    }
+};
+#endif
+
+namespace Draw {
+    // Insert drawing methods here...
+    SpriteBatch batch;
+    SDL_Color drawColor = { 255, 255, 255, 255 };
+    
+    void color(float r, float g, float b) {
+        float ar = r * 255;
+        float ag = g * 255; 
+        float ab = b * 255;
+        
+        Utils::clamp(ar, 0, 255);
+        Utils::clamp(ag, 0, 255);
+        Utils::clamp(ab, 0, 255); 
+        drawColor = { (Uint8) ar, (Uint8) ag, (Uint8) ab, 255 };
+        SDL_SetRenderDrawColor(renderer, (int) ar, (int) ag, (int) ab, 255);
+    };
+    // Batched sprite centered on (x, y)
+    void sprite(const Sprite *sprite, float x, float y, float w, float h)
+    {
+        float x0 = x - w / 2, y0 = y - h / 2;
+        const SDL_FPoint corners[4] = { { x0, y0 }, { x0 + w, y0 }, { x0 + w, y0 + h }, { x0, y0 + h } };
+        batch.quad(sprite, corners, { 255, 255, 255, 255 });
+    }
+    // Batched sprite with its top left corner on (x, y), rotated clockwise around its center
+    void rotated_sprite(const Sprite *sprite, float x, float y, float width, float height, float angle)
+    {
+        // Sub-pixel error even on sprites thousands of pixels wide
+        float s, c;
+        Trig::sincos<Trig::TRIG_FAST>(angle, s, c);
+        float cx = x + width / 2, cy = y + height / 2;
+        float hw = width / 2, hh = height / 2;
+        const float local[4][2] = { { -hw, -hh }, { hw, -hh }, { hw, hh }, { -hw, hh } };
+        
+        SDL_FPoint corners[4];
+        for (int i = 0; i < 4; i++) {
+            corners[i].x = cx + local[i][0] * c - local[i][1] * s;
+            corners[i].y = cy + local[i][0] * s + local[i][1] * c;
+        }
+        batch.quad(sprite, corners, { 255, 255, 255, 255 });
+    }
+    // Submits everything batched so far
+    void flush()
+    {
+        batch.flush();
+    }
+    void texture(SDL_Texture *tex, int x, int y, int w, int h)
+    { 
+        int sw = (int) w;
+        int sh = (int) h;
+        SDL_Rect cRect = {(int) x - sw / 2, (int) y - sh / 2, sw, sh};
+        SDL_Rect v = Utils::get_viewport_rect();
+        if (Utils::rectangle_collide(&cRect, &v))
+            SDL_RenderCopy(renderer, tex, NULL, &cRect);
+    }
+    void texture_uncentered(SDL_Texture *tex, int x, int y, int width, int height)
+    { 
+        int sw = (int) width;
+        int sh = (int) height;
+        SDL_Rect cRect = {x, y, sw, sh};
+        SDL_Rect v = Utils::get_viewport_rect();
+        if (Utils::rectangle_collide(&cRect, &v))
+            SDL_RenderCopy(renderer, tex, NULL, &cRect);
+    }
+    void rotated_texture(SDL_Texture *tex, int x, int y, int width, int height, float angle)
+    {
+        int sw = (int) width;
+        int sh = (int) height;
+        SDL_Rect cRect = {x, y, sw, sh};
+        SDL_RenderCopyEx(renderer, tex, NULL, &cRect, angle, NULL, SDL_FLIP_NONE);
+    }
+    void rect_fill_uncentered(int x, int y, int w, int h)
+    {
+        SDL_Rect dest = { x, y, w, h };
+        SDL_RenderFillRect(renderer, &dest);
+    } 
+    void rect_fill(int x, int y, int w, int h)
+    {
+        SDL_Rect dest = { x - w / 2, y - h / 2, w, h };
+        if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT) 
+            SDL_RenderFillRect(renderer, &dest);
+    }
+    void line(int x1, int y1, int x2, int y2)
+    {
+        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+    }
+    // One pixel wide line drawn as a quad in the sprite batch, using the current color
+    void batched_line(float x1, float y1, float x2, float y2)
+    {
+        Sprite *white = Assets::get().white_sprite();
+        if (white->texture == nullptr) {
+            SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+            return;
+        }
+        float dx = x2 - x1, dy = y2 - y1;
+        float len = sqrt(dx * dx + dy * dy);
+        if (len == 0) return;
+        
+        float nx = -dy / len * 0.5f, ny = dx / len * 0.5f;
+        const SDL_FPoint corners[4] = { { x1 + nx, y1 + ny }, { x2 + nx, y2 + ny }, { x2 - nx, y2 - ny }, { x1 - nx, y1 - ny } };
+        batch.quad(Assets::get().white_sprite(), corners, drawColor);
+    }
+    
+    // Static layer chunk kept as a texture, render thread only
+    struct CachedChunk {
+        SDL_Texture *texture = nullptr;
+        unsigned long long hash = 0;
+        // A sprite wasn't loaded yet when it was drawn, so it gets drawn again
+        bool complete = false;
+        Uint64 lastShown = 0;
+    };
+    // A view reaches into at most 3 x 3 chunks, 640 px starting anywhere in a 512 px chunk.
+    // The rest of the cache keeps chunks for when the camera comes back.
+    const int VIEW_CHUNKS = (SCREEN_WIDTH / StaticLayer::CHUNK_SIZE + 2) * (SCREEN_HEIGHT / StaticLayer::CHUNK_SIZE + 2);
+    const int MAX_CACHED_CHUNKS = 16;
+    // Eviction never takes a chunk shown this frame
+    static_assert(MAX_CACHED_CHUNKS >= VIEW_CHUNKS, "the static layer cache can't hold a whole view");
+    std::unordered_map<long long, CachedChunk> staticChunks;
+    // Textures of evicted chunks, reused before new ones are created
+    std::vector<SDL_Texture*> spareChunks;
+    // -1 until the renderer is asked
+    int renderTargets = -1;
+    SDL_BlendMode chunkBlending = SDL_BLENDMODE_BLEND;
+    Uint64 staticFrame = 0;
+    // Frame each shape was last drawn in when falling back to drawing shapes
+    std::vector<Uint64> shapeDrawn;
+    StaticLayerStats staticStats;
+    
+    // Draws a static shape moved by (dx, dy), returns false when its sprite isn't loaded yet
+    static bool static_shape(const DrawItem &item, float dx, float dy)
+    {
+        Assets &assets = Assets::get();
+        float x = item.from.x + dx, y = item.from.y + dy;
+        switch (item.kind) {
+            case DRAW_SPRITE:
+                sprite(assets.sprite(item.texture), x, y, item.width, item.height);
+                return assets.sprite(item.texture)->texture != nullptr;
+            case DRAW_ROTATED_SPRITE:
+                rotated_sprite(assets.sprite(item.texture), x, y, item.width, item.height, item.angle);
+                return assets.sprite(item.texture)->texture != nullptr;
+            case DRAW_LINE:
+                batched_line(x, y, item.endFrom.x + dx, item.endFrom.y + dy);
+                return assets.white_sprite()->texture != nullptr;
+        }
+        return true;
+    }
+    static void report_static_stats()
+    {
+        PROFILE_COUNTER("static chunks shown", staticStats.chunksShown);
+        PROFILE_COUNTER("static chunks drawn again", staticStats.chunksRendered);
+        PROFILE_COUNTER("static layer KB", staticStats.bytes / 1024.0f);
+    }
+    // Draws a chunk of the layer into its texture
+    static bool render_chunk(const StaticLayer &layer, const StaticLayer::Chunk &chunk, CachedChunk &cached)
+    {
+        const int size = StaticLayer::CHUNK_SIZE;
+        if (cached.texture == nullptr && !spareChunks.empty()) {
+            cached.texture = spareChunks.back();
+            spareChunks.pop_back();
+        }
+        if (cached.texture == nullptr) {
+            cached.texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, size, size);
+            if (cached.texture == nullptr) {
+                fprintf(stderr, "SDL_CreateTexture Error: %s\n", SDL_GetError());
+                return false;
+            }
+            // The texture ends up with premultiplied alpha, blending it again as straight alpha would darken soft edges
+            if (SDL_SetTextureBlendMode(cached.texture, chunkBlending) != 0) {
+                chunkBlending = SDL_BLENDMODE_BLEND;
+                SDL_SetTextureBlendMode(cached.texture, chunkBlending);
+            }
+        }
+        // Whatever is batched so far belongs on the screen
+        batch.flush();
+        SDL_SetRenderTarget(renderer, cached.texture);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0);
+        SDL_RenderClear(renderer);
+        SDL_SetRenderDrawColor(renderer, drawColor.r, drawColor.g, drawColor.b, drawColor.a);
+        
+        bool complete = true;
+        float dx = -(float) chunk.x * size, dy = -(float) chunk.y * size;
+        for (int i = chunk.first; i < chunk.first + chunk.count; i++) {
+            complete = static_shape(layer.shapes[layer.chunkShapes[i]], dx, dy) && complete;
+        }
+        batch.flush();
+        SDL_SetRenderTarget(renderer, nullptr);
+        
+        cached.hash = chunk.hash;
+        cached.complete = complete;
+        staticStats.chunksRendered++;
+        return true;
+    }
+    void static_layer(const StaticLayer &layer)
+    {
+        PROFILE_SCOPE("static layer");
+        const int size = StaticLayer::CHUNK_SIZE;
+        float left = Projection::cameraX - SCREEN_WIDTH / 2, top = Projection::cameraY - SCREEN_HEIGHT / 2;
+        int x0 = (int) floor(left / size), x1 = (int) floor((left + SCREEN_WIDTH) / size);
+        int y0 = (int) floor(top / size), y1 = (int) floor((top + SCREEN_HEIGHT) / size);
+        
+        if (renderTargets < 0) {
+            renderTargets = SDL_RenderTargetSupported(renderer);
+            chunkBlending = SDL_ComposeCustomBlendMode(SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD,
+                                                       SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+        }
+        staticFrame++;
+        staticStats.chunksShown = 0;
+        staticStats.chunksRendered = 0;
+        
+        if (!renderTargets) {
+            // Shapes reaching into several chunks are drawn once
+            shapeDrawn.resize(layer.shapes.size(), 0);
+            float dx = SCREEN_WIDTH / 2 - Projection::cameraX, dy = SCREEN_HEIGHT / 2 - Projection::cameraY;
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    const StaticLayer::Chunk *chunk = layer.find(x, y);
+                    if (chunk == nullptr) continue;
+                    staticStats.chunksShown++;
+                    for (int i = chunk->first; i < chunk->first + chunk->count; i++) {
+                        int shape = layer.chunkShapes[i];
+                        if (shapeDrawn[shape] == staticFrame) continue;
+                        shapeDrawn[shape] = staticFrame;
+                        static_shape(layer.shapes[shape], dx, dy);
+                    }
+                }
+            }
+            report_static_stats();
+            return;
+        }
+        
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                const StaticLayer::Chunk *chunk = layer.find(x, y);
+                if (chunk == nullptr) continue;
+                
+                CachedChunk &cached = staticChunks[StaticLayer::key(x, y)];
+                cached.lastShown = staticFrame;
+                if (cached.texture == nullptr || cached.hash != chunk->hash || !cached.complete) {
+                    if (!render_chunk(layer, *chunk, cached)) continue;
+                }
+                // Floored rather than truncated like world_to_screen, so neighbours always meet
+                SDL_Rect dest = { (int) floor(SCREEN_WIDTH / 2 + (float) x * size - Projection::cameraX),
+                                  (int) floor(SCREEN_HEIGHT / 2 + (float) y * size - Projection::cameraY), size, size };
+                SDL_RenderCopy(renderer, cached.texture, NULL, &dest);
+                staticStats.chunksShown++;
+            }
+        }
+        
+        // Least recently shown chunks give their texture up first
+        while ((int) staticChunks.size() > MAX_CACHED_CHUNKS) {
+            auto oldest = staticChunks.begin();
+            for (auto it = staticChunks.begin(); it != staticChunks.end(); ++it) {
+                if (it->second.lastShown < oldest->second.lastShown) oldest = it;
+            }
+            if (oldest->second.lastShown == staticFrame) break;
+            if (oldest->second.texture != nullptr) spareChunks.push_back(oldest->second.texture);
+            staticChunks.erase(oldest);
+        }
+        staticStats.cachedChunks = staticChunks.size();
+        staticStats.bytes = (staticChunks.size() + spareChunks.size()) * size * size * 4;
+        report_static_stats();
+    }
+    void reset_static_layer()
+    {
+        for (auto &chunk : staticChunks) {
+            if (chunk.second.texture != nullptr) SDL_DestroyTexture(chunk.second.texture);
+        }
+        for (auto &texture : spareChunks) {
+            SDL_DestroyTexture(texture);
+        }
+        staticChunks.clear();
+        spareChunks.clear();
+        staticStats = StaticLayerStats{};
+    }
+    StaticLayerStats static_layer_stats()
+    {
+        return staticStats;
+    }
+};
+
+void WorldObject::draw(std::vector<DrawItem> &out) {
+     switch (type) {
+          case SHAPE_BALL: ((Ball*) this)->draw(out); break;
+          case SHAPE_LINE: ((Line*) this)->draw(out); break;
+          case SHAPE_RECTANGLE: ((Rectangle*) this)->draw(out); break;
+          // Pendulums are drawn by their pin constraint
+          default: break;
+     }
+};
+
+void Rectangle::draw(std::vector<DrawItem> &out) {
+     out.push_back({ DRAW_ROTATED_SPRITE, rectangleSprite, position, position, {}, {}, width, height, angle });
+};
+
+void Ball::jump(float force, WorldObject *o) {
+     switch (o->type) {
+          case SHAPE_LINE: {
+               Vec2f normal = ((Line*) o)->normal;
+               vel.x += normal.x * vel.y;
+               vel.y += -force + normal.y;
+               break;
+          }
+          case SHAPE_RECTANGLE: {
+               Vec2f normal = collision((Rectangle*) o).intersection_point;
+               normal.subtract(position);
+               normal.norm();
+            
+               vel.x += normal.x * vel.y;
+               vel.y += -force + normal.y;
+               break;
+          }
+          case SHAPE_BALL: {
+               // Push apart along the line between the centers, straight right when they coincide
+               Ball *other = (Ball*) o;
+               Vec2f away = other->position - position;
+               float len = away.len();
+               float px = len > 0 ? away.x / len * force : force;
+               float py = len > 0 ? away.y / len * force : 0;
+               
+               vel.x -= px;
+               vel.y -= py;
+               
+               other->vel.x += px;
+               other->vel.y += py;
+               break;
+          }
+          default:
+               break;
+     }
+};
+void Ball::update(float timeTook) {
+    // Ball kinematics
+    acceleration.x = -vel.x * resistance + Vars::gravity.x * 60;
+    acceleration.y = -vel.y * resistance + Vars::gravity.y * 60;
+    
+    vel.x += acceleration.x * timeTook;
+    vel.y += acceleration.y * timeTook;
+    
+    position.x += vel.x * timeTook;
+    position.y += vel.y * timeTook;
+    
+    respawn_if_fallen();
+    if (fabs(vel.len2()) < 0.01f) {
+        vel.set_zero();
+    }
+};
+CollisionData Ball::collision(WorldObject *object) {
+     switch (object->type) {
+          case SHAPE_LINE: return collision((Line*) object);
+          case SHAPE_RECTANGLE: return collision((Rectangle*) object);
+          case SHAPE_BALL: return collision((Ball*) object);
+          default: return CollisionData{};
+     }
+};
+// Colliding with a line
+CollisionData Ball::collision(Line *line) {
+     CollisionData data;
+     Vec2f v1 = line->position;
+     Vec2f v2 = line->endPosition;
+               
+     Vec2f vec1 = v2 - v1;
+     Vec2f vec2 = position - v1;
+    
+     float len = vec1.len2();
+     float dotProduct = vec1.dot_prod(vec2);
+     float alpha = Utils::another_clamp(dotProduct, 0, len) / len;
+    
+     Vec2f interp_point = v1;
+     interp_point.interpolate(v2, alpha);
+     
+     float dst = interp_point.dst2(position);
+     bool collided = dst <= radius * radius;
+               
+     data.intersection_point = interp_point;
+     data.collided = collided;
+     return data;
+};
+// Colliding with a rectangle, the intersection point is in world space
+CollisionData Ball::collision(Rectangle *dest) {
+     CollisionData data;
+     Vec2f r = dest->to_local(position);
+     Vec2f intersection = r;
+     Utils::clamp(intersection.x, -dest->width / 2, dest->width / 2);
+     Utils::clamp(intersection.y, -dest->height / 2, dest->height / 2);
+           
+     data.collided = r.dst2(intersection) <= radius * radius;
+     data.intersection_point = dest->to_world(intersection);
+     return data;
+};
+// Colliding with another ball
+CollisionData Ball::collision(Ball *other) {
+     CollisionData data;
+     float dst = position.dst2(other->position);
+     float r = other->radius;
+     bool intersecting = dst <= (radius + r) * (radius + r);
+    
+     data.intersection_point = { 0, 0 };
+     data.collided = intersecting;
+     return data;
+};
+
+void Ball::draw(std::vector<DrawItem> &out) {
+    out.push_back({ DRAW_SPRITE, ballSprite, drawn_from(), position, {}, {}, radius * 2, radius * 2, 0 });
+};
+
+
+void Line::bake() {
+    gradient = endPosition - position;
+    normal = gradient.perpendicular(side).normalized();
+};
+
+void Line::draw(std::vector<DrawItem> &out) {
+    out.push_back({ DRAW_LINE, -1, position, position, endPosition, endPosition, 0, 0, 0 });
+};
@@ -0,0 +1,4508 @@
+// Simulation core shared by the game and the benchmarks: math, assets, drawing, shapes,
+// collision, constraints, snapshots, level streaming and the Aluminium world itself
+#ifndef ALUMINIUM_H
+#define ALUMINIUM_H
+
+#include <SDL2/SDL_hints.h>
+#include <SDL2/SDL_render.h>
+#include <SDL2/SDL_timer.h>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <cstdint>
+#include <array>
+#include <utility>
+#include <tuple>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <new>
+#include <cmath>
+#include <algorithm>
+#include <unordered_set>
+#if defined(_WIN32)
+#include <cstdio>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#if defined(__SSE2__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+
+const int SCREEN_WIDTH = 640;
+const int SCREEN_HEIGHT = 640;
+
+// Physics runs at a fixed rate independently of rendering.
+// Swept collision keeps fast balls from tunneling, so the step can be twice as long as
+// the 1/120 it was before, which halves the physics cost per simulated second.
+const float FIXED_TIMESTEP = 1.0f / 60.0f;
+// Steps allowed per frame before the remaining backlog is dropped
+const int MAX_CATCH_UP_STEPS = 8;
+
+extern SDL_Renderer *renderer;
+
+namespace Projection {
+    inline float cameraX, cameraY;
+    inline void world_to_screen(float &outX, float &outY)
+    {
+        // SCREEN_WIDTH/HEIGHT are the relative positions
+        outX = (int)(SCREEN_WIDTH / 2 + outX - cameraX); 
+        outY = (int)(SCREEN_HEIGHT / 2 + outY - cameraY); 
+    }
+    inline void adjust_camera(float relativeX, float relativeY) {
+        cameraX = relativeX;
+        cameraY = relativeY;
+    }
+};
+
+// Polynomial sin, cos and atan2 in accuracy tiers, plus versions over packed arrays.
+// Each tier is a different set of minimax coefficients on the same range reduction:
+//  TRIG_FAST     about 1e-5 absolute error, for drawing and gameplay impulses
+//  TRIG_BALANCED within a few float ulps, for the simulation
+//  TRIG_PRECISE  libm
+// Angles beyond TRIG_REDUCTION_LIMIT radians fall back to libm in every tier.
+namespace Trig {
+    enum Accuracy {
+        TRIG_FAST,
+        TRIG_BALANCED,
+        TRIG_PRECISE
+    };
+    
+    const float TWO_OVER_PI = 0.636619772f;
+    const float HALF_PI = 1.57079633f;
+    const float QUARTER_PI = 0.785398163f;
+    const float PI = 3.14159265f;
+    const float TAN_PI_8 = 0.414213562f;
+    // pi / 2 split into parts with few enough mantissa bits that k * part is exact
+    const float PI_2_A = 1.5703125f;
+    const float PI_2_B = 4.837512969970703125e-4f;
+    const float PI_2_C = 7.54978995489188216e-8f;
+    // Keeps the quadrant count below 2^16, where the products above stay exact
+    const float TRIG_REDUCTION_LIMIT = 100000.0f;
+    
+    // sin(r) = r + r^3 * S(r^2) and cos(r) = 1 + r^2 * C(r^2) on [-pi/4, pi/4],
+    // atan(t) = t + t^3 * A(t^2) on [0, tan(pi/8)]
+    template <Accuracy A> struct Coefficients;
+    template <> struct Coefficients<TRIG_FAST> {
+        static constexpr int SIN_TERMS = 2, COS_TERMS = 2, ATAN_TERMS = 2;
+        static constexpr float sin[] = { -0.166628331f, 0.00815297454f };
+        static constexpr float cos[] = { -0.499776260f, 0.0404888107f };
+        static constexpr float atan[] = { -0.331567935f, 0.168563788f };
+    };
+    template <> struct Coefficients<TRIG_BALANCED> {
+        static constexpr int SIN_TERMS = 3, COS_TERMS = 4, ATAN_TERMS = 4;
+        static constexpr float sin[] = { -0.166666507f, 0.00833197849f, -0.000194956144f };
+        static constexpr float cos[] = { -0.499999997f, 0.0416666233f, -0.00138867639f, 0.0000243904575f };
+        static constexpr float atan[] = { -0.333327566f, 0.199718762f, -0.138244208f, 0.0790249168f };
+    };
+    
+    // Round to nearest even like the vector paths; nearbyint is an out of line libm call
+    inline int round_to_int(float x) {
+#if defined(__SSE2__)
+        return _mm_cvtss_si32(_mm_set_ss(x));
+#else
+        return (int) std::nearbyint(x);
+#endif
+    }
+    
+    // b when swap is 1, else a, negated when negate is 2. Done on the bits because random
+    // angles would mispredict a branch on the quadrant half the time.
+    inline float pick(float a, float b, int swap, int negate) {
+        unsigned int ua, ub;
+        memcpy(&ua, &a, sizeof(ua));
+        memcpy(&ub, &b, sizeof(ub));
+        unsigned int mask = 0u - (unsigned int) swap;
+        unsigned int u = ((ua & ~mask) | (ub & mask)) ^ ((unsigned int) negate << 30);
+        memcpy(&a, &u, sizeof(a));
+        return a;
+    }
+    
+    template <int N>
+    inline float horner(const float *c, float z) {
+        float p = c[N - 1];
+        for (int i = N - 2; i >= 0; i--) p = p * z + c[i];
+        return p;
+    }
+    
+    template <Accuracy A = TRIG_BALANCED>
+    inline void sincos(float x, float &s, float &c) {
+        if constexpr (A == TRIG_PRECISE) {
+            s = std::sin(x);
+            c = std::cos(x);
+        } else {
+            // Also catches NaN
+            if (!(std::fabs(x) <= TRIG_REDUCTION_LIMIT)) {
+                s = std::sin(x);
+                c = std::cos(x);
+                return;
+            }
+            typedef Coefficients<A> K;
+            int quadrant = round_to_int(x * TWO_OVER_PI);
+            float k = quadrant;
+            quadrant &= 3;
+            float r = ((x - k * PI_2_A) - k * PI_2_B) - k * PI_2_C;
+            float z = r * r;
+            float rs = r + r * z * horner<K::SIN_TERMS>(K::sin, z);
+            float rc = 1 + z * horner<K::COS_TERMS>(K::cos, z);
+            
+            // Odd quadrants swap sin and cos, the sign bits come from the quadrant
+            s = pick(rs, rc, quadrant & 1, quadrant & 2);
+            c = pick(rc, rs, quadrant & 1, (quadrant + 1) & 2);
+        }
+    }
+    template <Accuracy A = TRIG_BALANCED>
+    inline float sin(float x) {
+        float s, c;
+        sincos<A>(x, s, c);
+        return s;
+    }
+    template <Accuracy A = TRIG_BALANCED>
+    inline float cos(float x) {
+        float s, c;
+        sincos<A>(x, s, c);
+        return c;
+    }
+    // Same quadrants and signed zeros as libm for finite input, atan2(0, 0) is 0
+    template <Accuracy A = TRIG_BALANCED>
+    inline float atan2(float y, float x) {
+        if constexpr (A == TRIG_PRECISE) {
+            return std::atan2(y, x);
+        } else {
+            typedef Coefficients<A> K;
+            float ax = std::fabs(x), ay = std::fabs(y);
+            float hi = std::max(ax, ay), lo = std::min(ax, ay);
+            // Selected on the bits like sincos, each octant is equally likely
+            float t = pick(0, lo / hi, hi > 0, 0);
+            
+            // atan(t) = pi/4 + atan((t - 1) / (t + 1)) brings t under tan(pi/8)
+            int reduce = t > TAN_PI_8;
+            t = pick(t, (t - 1) / (t + 1), reduce, 0);
+            float z = t * t;
+            float a = pick(0, QUARTER_PI, reduce, 0) + (t + t * z * horner<K::ATAN_TERMS>(K::atan, z));
+            
+            a = pick(a, HALF_PI - a, ay > ax, 0);
+            a = pick(a, PI - a, std::signbit(x), 0);
+            return pick(a, a, 0, std::signbit(y) ? 2 : 0);
+        }
+    }
+    
+    // s[i] and c[i] = sin and cos of angle[i]. Outputs may alias the input.
+    template <Accuracy A = TRIG_BALANCED>
+    void sincos_n(const float *angle, float *s, float *c, int count) {
+        int i = 0;
+        if constexpr (A != TRIG_PRECISE) {
+            typedef Coefficients<A> K;
+#if defined(__AVX2__)
+            const __m256 twoOverPi = _mm256_set1_ps(TWO_OVER_PI), limit = _mm256_set1_ps(TRIG_REDUCTION_LIMIT);
+            const __m256 pa = _mm256_set1_ps(PI_2_A), pb = _mm256_set1_ps(PI_2_B), pc = _mm256_set1_ps(PI_2_C);
+            const __m256 one = _mm256_set1_ps(1), absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+            for (; i + 8 <= count; i += 8) {
+                __m256 x = _mm256_loadu_ps(angle + i);
+                __m256i ki = _mm256_cvtps_epi32(_mm256_mul_ps(x, twoOverPi));
+                __m256 k = _mm256_cvtepi32_ps(ki);
+                __m256 r = _mm256_sub_ps(_mm256_sub_ps(_mm256_sub_ps(x, _mm256_mul_ps(k, pa)), _mm256_mul_ps(k, pb)), _mm256_mul_ps(k, pc));
+                __m256 z = _mm256_mul_ps(r, r);
+                
+                __m256 ps = _mm256_set1_ps(K::sin[K::SIN_TERMS - 1]);
+                for (int j = K::SIN_TERMS - 2; j >= 0; j--) ps = _mm256_add_ps(_mm256_mul_ps(ps, z), _mm256_set1_ps(K::sin[j]));
+                __m256 pcos = _mm256_set1_ps(K::cos[K::COS_TERMS - 1]);
+                for (int j = K::COS_TERMS - 2; j >= 0; j--) pcos = _mm256_add_ps(_mm256_mul_ps(pcos, z), _mm256_set1_ps(K::cos[j]));
+                __m256 rs = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(r, z), ps));
+                __m256 rc = _mm256_add_ps(one, _mm256_mul_ps(z, pcos));
+                
+                // Odd quadrants swap sin and cos, the sign bits come from the quadrant
+                __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(ki, _mm256_set1_epi32(1)), _mm256_set1_epi32(1)));
+                __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(ki, _mm256_set1_epi32(2)), 30));
+                __m256 cosSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(ki, _mm256_set1_epi32(1)), _mm256_set1_epi32(2)), 30));
+                __m256 vs = _mm256_xor_ps(_mm256_blendv_ps(rs, rc, swap), sinSign);
+                __m256 vc = _mm256_xor_ps(_mm256_blendv_ps(rc, rs, swap), cosSign);
+                
+                // Lanes outside the reduction range are redone below
+                int outside = _mm256_movemask_ps(_mm256_cmp_ps(_mm256_and_ps(x, absMask), limit, _CMP_NLE_UQ));
+                _mm256_storeu_ps(s + i, vs);
+                _mm256_storeu_ps(c + i, vc);
+                for (int j = 0; outside != 0; j++, outside >>= 1) {
+                    if (outside & 1) sincos<TRIG_PRECISE>(angle[i + j], s[i + j], c[i + j]);
+                }
+            }
+#elif defined(__SSE2__)
+            const __m128 twoOverPi = _mm_set1_ps(TWO_OVER_PI), limit = _mm_set1_ps(TRIG_REDUCTION_LIMIT);
+            const __m128 pa = _mm_set1_ps(PI_2_A), pb = _mm_set1_ps(PI_2_B), pc = _mm_set1_ps(PI_2_C);
+            const __m128 one = _mm_set1_ps(1), absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+            for (; i + 4 <= count; i += 4) {
+                __m128 x = _mm_loadu_ps(angle + i);
+                __m128i ki = _mm_cvtps_epi32(_mm_mul_ps(x, twoOverPi));
+                __m128 k = _mm_cvtepi32_ps(ki);
+                __m128 r = _mm_sub_ps(_mm_sub_ps(_mm_sub_ps(x, _mm_mul_ps(k, pa)), _mm_mul_ps(k, pb)), _mm_mul_ps(k, pc));
+                __m128 z = _mm_mul_ps(r, r);
+                
+                __m128 ps = _mm_set1_ps(K::sin[K::SIN_TERMS - 1]);
+                for (int j = K::SIN_TERMS - 2; j >= 0; j--) ps = _mm_add_ps(_mm_mul_ps(ps, z), _mm_set1_ps(K::sin[j]));
+                __m128 pcos = _mm_set1_ps(K::cos[K::COS_TERMS - 1]);
+                for (int j = K::COS_TERMS - 2; j >= 0; j--) pcos = _mm_add_ps(_mm_mul_ps(pcos, z), _mm_set1_ps(K::cos[j]));
+                __m128 rs = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(r, z), ps));
+                __m128 rc = _mm_add_ps(one, _mm_mul_ps(z, pcos));
+                
+                // Odd quadrants swap sin and cos, the sign bits come from the quadrant
+                __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(ki, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+                __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(ki, _mm_set1_epi32(2)), 30));
+                __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(ki, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+                __m128 vs = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, rc), _mm_andnot_ps(swap, rs)), sinSign);
+                __m128 vc = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, rs), _mm_andnot_ps(swap, rc)), cosSign);
+                
+                // Lanes outside the reduction range are redone below
+                int outside = _mm_movemask_ps(_mm_cmpnle_ps(_mm_and_ps(x, absMask), limit));
+                _mm_storeu_ps(s + i, vs);
+                _mm_storeu_ps(c + i, vc);
+                for (int j = 0; outside != 0; j++, outside >>= 1) {
+                    if (outside & 1) sincos<TRIG_PRECISE>(angle[i + j], s[i + j], c[i + j]);
+                }
+            }
+#endif
+        }
+        for (; i < count; i++) {
+            float x = angle[i];
+            sincos<A>(x, s[i], c[i]);
+        }
+    }
+    // out[i] = atan2(y[i], x[i]). The output may alias either input.
+    template <Accuracy A = TRIG_BALANCED>
+    void atan2_n(const float *y, const float *x, float *out, int count) {
+        int i = 0;
+        if constexpr (A != TRIG_PRECISE) {
+            typedef Coefficients<A> K;
+#if defined(__AVX2__)
+            const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+            const __m256 signMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x80000000));
+            const __m256 tanPi8 = _mm256_set1_ps(TAN_PI_8), quarterPi = _mm256_set1_ps(QUARTER_PI);
+            const __m256 halfPi = _mm256_set1_ps(HALF_PI), pi = _mm256_set1_ps(PI);
+            for (; i + 8 <= count; i += 8) {
+                __m256 vy = _mm256_loadu_ps(y + i), vx = _mm256_loadu_ps(x + i);
+                __m256 ax = _mm256_andnot_ps(signMask, vx), ay = _mm256_andnot_ps(signMask, vy);
+                __m256 hi = _mm256_max_ps(ax, ay), lo = _mm256_min_ps(ax, ay);
+                __m256 t = _mm256_and_ps(_mm256_div_ps(lo, hi), _mm256_cmp_ps(hi, zero, _CMP_GT_OQ));
+                
+                __m256 reduce = _mm256_cmp_ps(t, tanPi8, _CMP_GT_OQ);
+                t = _mm256_blendv_ps(t, _mm256_div_ps(_mm256_sub_ps(t, one), _mm256_add_ps(t, one)), reduce);
+                __m256 base = _mm256_and_ps(reduce, quarterPi);
+                __m256 z = _mm256_mul_ps(t, t);
+                __m256 p = _mm256_set1_ps(K::atan[K::ATAN_TERMS - 1]);
+                for (int j = K::ATAN_TERMS - 2; j >= 0; j--) p = _mm256_add_ps(_mm256_mul_ps(p, z), _mm256_set1_ps(K::atan[j]));
+                __m256 a = _mm256_add_ps(base, _mm256_add_ps(t, _mm256_mul_ps(_mm256_mul_ps(t, z), p)));
+                
+                a = _mm256_blendv_ps(a, _mm256_sub_ps(halfPi, a), _mm256_cmp_ps(ay, ax, _CMP_GT_OQ));
+                a = _mm256_blendv_ps(a, _mm256_sub_ps(pi, a), vx);
+                _mm256_storeu_ps(out + i, _mm256_or_ps(a, _mm256_and_ps(vy, signMask)));
+            }
+#elif defined(__SSE2__)
+            const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1);
+            const __m128 signMask = _mm_castsi128_ps(_mm_set1_epi32(0x80000000));
+            const __m128 tanPi8 = _mm_set1_ps(TAN_PI_8), quarterPi = _mm_set1_ps(QUARTER_PI);
+            const __m128 halfPi = _mm_set1_ps(HALF_PI), pi = _mm_set1_ps(PI);
+            for (; i + 4 <= count; i += 4) {
+                __m128 vy = _mm_loadu_ps(y + i), vx = _mm_loadu_ps(x + i);
+                __m128 ax = _mm_andnot_ps(signMask, vx), ay = _mm_andnot_ps(signMask, vy);
+                __m128 hi = _mm_max_ps(ax, ay), lo = _mm_min_ps(ax, ay);
+                __m128 t = _mm_and_ps(_mm_div_ps(lo, hi), _mm_cmpgt_ps(hi, zero));
+                
+                __m128 reduce = _mm_cmpgt_ps(t, tanPi8);
+                __m128 reduced = _mm_div_ps(_mm_sub_ps(t, one), _mm_add_ps(t, one));
+                t = _mm_or_ps(_mm_and_ps(reduce, reduced), _mm_andnot_ps(reduce, t));
+                __m128 base = _mm_and_ps(reduce, quarterPi);
+                __m128 z = _mm_mul_ps(t, t);
+                __m128 p = _mm_set1_ps(K::atan[K::ATAN_TERMS - 1]);
+                for (int j = K::ATAN_TERMS - 2; j >= 0; j--) p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(K::atan[j]));
+                __m128 a = _mm_add_ps(base, _mm_add_ps(t, _mm_mul_ps(_mm_mul_ps(t, z), p)));
+                
+                __m128 steep = _mm_cmpgt_ps(ay, ax);
+                a = _mm_or_ps(_mm_and_ps(steep, _mm_sub_ps(halfPi, a)), _mm_andnot_ps(steep, a));
+                // Arithmetic shift spreads the sign bit of x over the lane
+                __m128 behind = _mm_castsi128_ps(_mm_srai_epi32(_mm_castps_si128(vx), 31));
+                a = _mm_or_ps(_mm_and_ps(behind, _mm_sub_ps(pi, a)), _mm_andnot_ps(behind, a));
+                _mm_storeu_ps(out + i, _mm_or_ps(a, _mm_and_ps(vy, signMask)));
+            }
+#endif
+        }
+        for (; i < count; i++) {
+            out[i] = atan2<A>(y[i], x[i]);
+        }
+    }
+};
+
+namespace Utils {
+    // Insert utilities here...
+    inline float clamp(float &value, float min, float max)
+    {
+        if (value < min) value = min;
+        else if (value > max) value = max;
+        
+        return value;
+    }
+    inline float another_clamp(float &value, float min, float max)
+    {
+        return std::max(min, std::min(max, value));
+    }
+    inline float interp(float from, float to, float progress) {
+        return progress * (to - from);
+    }
+    inline SDL_Rect get_viewport_rect()
+    {
+        return { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
+    }
+    inline bool rectangle_collide(const SDL_Rect *r1, const SDL_Rect *r2)
+    {
+        SDL_bool intersect = SDL_HasIntersection(r1, r2);
+        return intersect == SDL_TRUE ? true : false;
+    }
+    inline float radians(float degrees) {
+        return degrees / 180 * M_PI;
+    }
+    inline float degrees(float radians) {
+        return radians * 180 / M_PI;
+    }
+    // Seconds elapsed since a performance counter reading
+    inline double seconds_since(Uint64 start) {
+        return (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+    }
+    inline float f_sin(float a) {
+        return Trig::sin(radians(a));
+    }
+    inline float f_cos(float a) {
+        return Trig::cos(radians(a));
+    }
+};
+
+// Rolling window of frame times, in milliseconds, for percentiles
+class FrameTimes {
+    std::vector<float> samples, sorted;
+    int window;
+    int next = 0;
+    public:
+        FrameTimes(int window) {
+            this->window = window;
+        }
+        void add(float ms) {
+            if ((int) samples.size() < window) samples.push_back(ms);
+            else samples[next] = ms;
+            next = (next + 1) % window;
+        }
+        // p between 0 and 1, 0 when nothing was recorded yet
+        float percentile(float p) {
+            if (samples.empty()) return 0;
+            sorted = samples;
+            size_t k = std::min(sorted.size() - 1, (size_t) (p * sorted.size()));
+            std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+            return sorted[k];
+        }
+        int count() {
+            return samples.size();
+        }
+};
+
+// How much work a step and a frame do
+struct Quality {
+    // Contact solver passes, and rope substeps
+    int velocityIterations, positionIterations, constraintSubsteps;
+    // Balls farther than this from the camera may fall asleep early, 0 for none. Never less
+    // than SCREEN_WIDTH, so only balls off the screen are affected.
+    float farDistance;
+    // Ropes and rods between balls
+    bool drawJoints;
+};
+
+struct BudgetStats {
+    int level = 0;
+    float budgetMs = 0, averageMs = 0;
+    int frames = 0, overBudgetFrames = 0;
+    int degradations = 0, restorations = 0;
+};
+
+// Lowers the quality a level once frames keep running over budget and raises it again after
+// a longer stretch of headroom. A level that has to be dropped again soon after it was restored
+// waits twice as long for the next try, so a load right at the edge doesn't flip back and forth.
+class FrameBudget {
+    float budgetMs;
+    int overFrames = 0, underFrames = 0;
+    // Frames of headroom needed before restoring, and frames since the last restore
+    int restoreFrames, sinceRestore;
+    BudgetStats stats;
+    public:
+        static const int LEVEL_COUNT = 4;
+        // Moving average weight of the newest frame
+        static constexpr float SMOOTHING = 0.1f;
+        // Averages above this fraction of the budget count as over, below the other as headroom
+        static constexpr float OVER_FRACTION = 0.9f;
+        static constexpr float HEADROOM_FRACTION = 0.6f;
+        // A single frame this many budgets long drops a level right away
+        static constexpr float SPIKE_BUDGETS = 2.0f;
+        static const int DEGRADE_FRAMES = 5;
+        static const int RESTORE_FRAMES = 120;
+        static const int MAX_RESTORE_FRAMES = RESTORE_FRAMES * 16;
+
+        // 0 or less never changes the level
+        FrameBudget(float budgetMs) {
+            this->budgetMs = budgetMs;
+            restoreFrames = RESTORE_FRAMES;
+            sinceRestore = MAX_RESTORE_FRAMES;
+            stats.budgetMs = budgetMs;
+        }
+        // Offscreen balls settle first, then every pass is cut, then ropes aren't drawn
+        static Quality level_quality(int level) {
+            static const Quality levels[LEVEL_COUNT] = {
+                { 8, 2, 8, 0, true },
+                { 8, 2, 8, SCREEN_WIDTH, true },
+                { 4, 1, 4, SCREEN_WIDTH, true },
+                { 2, 1, 2, SCREEN_WIDTH, false }
+            };
+            return levels[std::max(0, std::min(level, LEVEL_COUNT - 1))];
+        }
+        Quality quality() {
+            return level_quality(stats.level);
+        }
+        // Records what the latest frame cost. Returns whether the level changed.
+        bool add(float ms) {
+            stats.frames++;
+            stats.averageMs = stats.frames == 1 ? ms : stats.averageMs + (ms - stats.averageMs) * SMOOTHING;
+            if (budgetMs <= 0) return false;
+            if (ms > budgetMs) stats.overBudgetFrames++;
+            sinceRestore++;
+
+            bool spike = ms > budgetMs * SPIKE_BUDGETS;
+            overFrames = stats.averageMs > budgetMs * OVER_FRACTION ? overFrames + 1 : 0;
+            underFrames = stats.averageMs < budgetMs * HEADROOM_FRACTION ? underFrames + 1 : 0;
+
+            if ((spike || overFrames >= DEGRADE_FRAMES) && stats.level < LEVEL_COUNT - 1) {
+                restoreFrames = sinceRestore < restoreFrames ? std::min(restoreFrames * 2, MAX_RESTORE_FRAMES) : RESTORE_FRAMES;
+                stats.level++;
+                stats.degradations++;
+                overFrames = underFrames = 0;
+                // The average still holds the slow frames, start over from the latest one
+                stats.averageMs = ms;
+                return true;
+            }
+            if (underFrames >= restoreFrames && stats.level > 0) {
+                stats.level--;
+                stats.restorations++;
+                overFrames = underFrames = sinceRestore = 0;
+                return true;
+            }
+            return false;
+        }
+        BudgetStats get_stats() {
+            return stats;
+        }
+};
+
+// Scoped timers for finding where frame time goes. Every thread records into its own
+// ring buffer without locking; the oldest events are overwritten once a buffer is full.
+// Build with -DALUMINIUM_NO_PROFILE to compile all of it out.
+#if !defined(ALUMINIUM_NO_PROFILE)
+namespace Profiler {
+    struct Event {
+        // Must be a string literal, only the pointer is kept
+        const char *name;
+        Uint64 start, end;
+        // Counter events carry a value instead of a duration
+        bool counter;
+        float value;
+    };
+    
+    struct ThreadBuffer {
+        static const int CAPACITY = 1 << 16;
+        std::vector<Event> events;
+        // Total events ever written, only the owning thread stores to it
+        std::atomic<unsigned int> head{ 0 };
+        int id;
+        const char *threadName = "thread";
+        // Set when the owning thread exits so the next new thread reuses the buffer
+        bool released = false;
+        
+        ThreadBuffer(int id) : events(CAPACITY) {
+            this->id = id;
+        }
+        void push(const Event &e) {
+            unsigned int h = head.load(std::memory_order_relaxed);
+            events[h % CAPACITY] = e;
+            head.store(h + 1, std::memory_order_release);
+        }
+    };
+    
+    inline std::atomic<bool> recording{ false };
+    
+    inline bool enabled() {
+        return recording.load(std::memory_order_relaxed);
+    }
+    void set_enabled(bool enabled);
+    // Registers the calling thread on its first event
+    ThreadBuffer &thread_buffer();
+    // Label for the calling thread's track in the trace, must be a string literal
+    void name_thread(const char *name);
+    void counter(const char *name, float value);
+    class Scope {
+        const char *name;
+        Uint64 start = 0;
+        public:
+            Scope(const char *name) {
+                this->name = name;
+                if (enabled()) start = SDL_GetPerformanceCounter();
+            }
+            ~Scope() {
+                // Scopes opened before recording started are dropped
+                if (start != 0 && enabled()) thread_buffer().push({ name, start, SDL_GetPerformanceCounter(), false, 0 });
+            }
+    };
+    
+    // Writes every buffered event as Chrome trace JSON (chrome://tracing, Perfetto).
+    // Call while no other thread is recording, e.g. between frames.
+    bool export_trace(const char *path);
+};
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+// Times the rest of the enclosing block under a string literal name
+#define PROFILE_SCOPE(name) Profiler::Scope PROFILE_CONCAT(profileScope, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::counter(name, value)
+#define PROFILE_THREAD(name) Profiler::name_thread(name)
+#else
+namespace Profiler {
+    constexpr bool enabled() {
+        return false;
+    }
+};
+#define PROFILE_SCOPE(name) do {} while (0)
+#define PROFILE_COUNTER(name, value) do {} while (0)
+#define PROFILE_THREAD(name) do {} while (0)
+#endif
+
+// Plain 2D vector. Kept trivial so it can live in unions and be copied as bytes.
+// The mutating methods return *this for chaining, everything else works on copies.
+struct Vec2f {
+    float x, y;
+    
+    constexpr Vec2f operator + (Vec2f other) const {
+        return { x + other.x, y + other.y };
+    }
+    constexpr Vec2f operator - (Vec2f other) const {
+        return { x - other.x, y - other.y };
+    }
+    constexpr Vec2f operator - () const {
+        return { -x, -y };
+    }
+    constexpr Vec2f operator * (float scalar) const {
+        return { x * scalar, y * scalar };
+    }
+    constexpr Vec2f &operator += (Vec2f other) {
+        x += other.x;
+        y += other.y;
+        return *this;
+    }
+    constexpr Vec2f &operator -= (Vec2f other) {
+        x -= other.x;
+        y -= other.y;
+        return *this;
+    }
+    constexpr Vec2f &operator *= (float scalar) {
+        x *= scalar;
+        y *= scalar;
+        return *this;
+    }
+    constexpr bool operator == (Vec2f other) const {
+        return x == other.x && y == other.y;
+    }
+    constexpr bool operator != (Vec2f other) const {
+        return !(*this == other);
+    }
+    
+    constexpr void set_zero() {
+        x = 0;
+        y = 0;
+    }
+    constexpr float dot_prod(Vec2f other) const {
+        return x * other.x + y * other.y;
+    }
+    constexpr float cross_prod(Vec2f other) const {
+        return x * other.y - y * other.x;
+    }
+    constexpr Vec2f perpendicular(int side) const {
+        float j = side >= 0 ? 1 : -1;
+        return { j * y, -j * x };
+    }
+    float len() const {
+        return sqrt(x*x + y*y);
+    }
+    constexpr float len2() const {
+        return x*x + y*y;
+    }
+    float dst(Vec2f other) const {
+        return sqrt(dst2(other));
+    }
+    constexpr float dst2(Vec2f other) const {
+        float dx = x - other.x;
+        float dy = y - other.y;
+        
+        return dx * dx + dy * dy;
+    }
+    // Like norm(), a zero vector has no direction and comes out as NaN
+    Vec2f normalized() const {
+        return *this * (1 / len());
+    }
+    Vec2f rotated(float angle) const {
+        float s, c;
+        Trig::sincos(angle, s, c);
+        return { x * c - y * s, x * s + y * c };
+    }
+    
+    constexpr Vec2f &multiply(float scalar) {
+        return *this *= scalar;
+    }
+    Vec2f &norm() {
+        return multiply(1 / len());
+    }
+    constexpr Vec2f &subtract(Vec2f other) {
+        return *this -= other;
+    }
+    constexpr Vec2f &add(float ox, float oy) {
+        x += ox;
+        y += oy;
+        return *this;
+    }
+    constexpr Vec2f &interpolate(Vec2f other, float progress) {
+        x = x + (other.x - x) * progress;
+        y = y + (other.y - y) * progress;
+        return *this;
+    }
+    Vec2f &rotate(float angle) {
+        return *this = rotated(angle);
+    }
+};
+constexpr Vec2f operator * (float scalar, Vec2f v) {
+    return v * scalar;
+}
+
+// Vec2f operations over packed arrays, one array per component. Outputs may alias inputs.
+// Every element goes through the same operations in the same order as the Vec2f version.
+namespace VecBatch {
+    // Rotates every vector by the same angle
+    inline void rotate_n(float *x, float *y, int count, float angle) {
+        float s, c;
+        Trig::sincos(angle, s, c);
+        int i = 0;
+#if defined(__AVX2__)
+        const __m256 vc = _mm256_set1_ps(c), vs = _mm256_set1_ps(s);
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+            _mm256_storeu_ps(x + i, _mm256_sub_ps(_mm256_mul_ps(px, vc), _mm256_mul_ps(py, vs)));
+            _mm256_storeu_ps(y + i, _mm256_add_ps(_mm256_mul_ps(px, vs), _mm256_mul_ps(py, vc)));
+        }
+#elif defined(__SSE2__)
+        const __m128 vc = _mm_set1_ps(c), vs = _mm_set1_ps(s);
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+            _mm_storeu_ps(x + i, _mm_sub_ps(_mm_mul_ps(px, vc), _mm_mul_ps(py, vs)));
+            _mm_storeu_ps(y + i, _mm_add_ps(_mm_mul_ps(px, vs), _mm_mul_ps(py, vc)));
+        }
+#endif
+        for (; i < count; i++) {
+            float px = x[i], py = y[i];
+            x[i] = px * c - py * s;
+            y[i] = px * s + py * c;
+        }
+    }
+    // out[i] = squared distance between (ax[i], ay[i]) and (bx[i], by[i])
+    inline void dst2_n(const float *ax, const float *ay, const float *bx, const float *by, int count, float *out) {
+        int i = 0;
+#if defined(__AVX2__)
+        for (; i + 8 <= count; i += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+            __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(ay + i), _mm256_loadu_ps(by + i));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)));
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i));
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i));
+            _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)));
+        }
+#endif
+        for (; i < count; i++) {
+            float dx = ax[i] - bx[i], dy = ay[i] - by[i];
+            out[i] = dx * dx + dy * dy;
+        }
+    }
+    // out[i] = dot product of (ax[i], ay[i]) and (bx[i], by[i])
+    inline void dot_n(const float *ax, const float *ay, const float *bx, const float *by, int count, float *out) {
+        int i = 0;
+#if defined(__AVX2__)
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_mul_ps(_mm256_loadu_ps(ax + i), _mm256_loadu_ps(bx + i));
+            __m256 py = _mm256_mul_ps(_mm256_loadu_ps(ay + i), _mm256_loadu_ps(by + i));
+            _mm256_storeu_ps(out + i, _mm256_add_ps(px, py));
+        }
+#elif defined(__SSE2__)
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = _mm_mul_ps(_mm_loadu_ps(ax + i), _mm_loadu_ps(bx + i));
+            __m128 py = _mm_mul_ps(_mm_loadu_ps(ay + i), _mm_loadu_ps(by + i));
+            _mm_storeu_ps(out + i, _mm_add_ps(px, py));
+        }
+#endif
+        for (; i < count; i++) {
+            out[i] = ax[i] * bx[i] + ay[i] * by[i];
+        }
+    }
+    // Scales every vector to unit length. Uses a real square root and division rather than
+    // the reciprocal estimate, and zero vectors come out as NaN just like Vec2f::norm.
+    inline void normalize_n(float *x, float *y, int count) {
+        int i = 0;
+#if defined(__AVX2__)
+        const __m256 one = _mm256_set1_ps(1);
+        for (; i + 8 <= count; i += 8) {
+            __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+            __m256 inv = _mm256_div_ps(one, _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(px, px), _mm256_mul_ps(py, py))));
+            _mm256_storeu_ps(x + i, _mm256_mul_ps(px, inv));
+            _mm256_storeu_ps(y + i, _mm256_mul_ps(py, inv));
+        }
+#elif defined(__SSE2__)
+        const __m128 one = _mm_set1_ps(1);
+        for (; i + 4 <= count; i += 4) {
+            __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+            __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(px, px), _mm_mul_ps(py, py))));
+            _mm_storeu_ps(x + i, _mm_mul_ps(px, inv));
+            _mm_storeu_ps(y + i, _mm_mul_ps(py, inv));
+        }
+#endif
+        for (; i < count; i++) {
+            float inv = 1 / sqrtf(x[i] * x[i] + y[i] * y[i]);
+            x[i] *= inv;
+            y[i] *= inv;
+        }
+    }
+};
+
+enum LoadStages{
+    TEXTURES
+};
+
+// Region of a texture (normally the atlas) that a sprite is drawn from
+struct Sprite {
+    SDL_Texture *texture = nullptr;
+    SDL_Rect source = { 0, 0, 0, 0 };
+    // Normalized texture coordinates of the region
+    float u0 = 0, v0 = 0, u1 = 0, v1 = 0;
+};
+
+// Interned texture name, an index into the asset tables
+typedef int TextureHandle;
+
+class Assets {
+    struct DecodeJob {
+        TextureHandle handle;
+        std::string path;
+        SDL_Surface *surface;
+    };
+    std::unordered_map<std::string, TextureHandle> handles;
+    std::vector<std::string> names;
+    std::vector<Sprite> sprites;
+    // Every load builds one atlas page
+    std::vector<SDL_Texture*> atlases;
+    // Plain white texels, for drawing untextured geometry in the same batch as sprites
+    Sprite white;
+    
+    std::vector<DecodeJob> jobs;
+    std::vector<std::thread> decoders;
+    std::atomic<int> nextJob{ 0 }, decodedJobs{ 0 };
+    // Tells decoders to stop taking jobs
+    std::atomic<bool> cancelled{ false };
+    unsigned int startedStages = 0;
+    // Streamed textures waiting for the current load to finish, and every handle ever requested
+    std::vector<TextureHandle> pendingStream;
+    std::vector<char> requested;
+    // Guards the handle tables, which the simulation grows while the renderer reads sprites
+    std::mutex mutex;
+    
+    TextureHandle intern_locked(const char *location) {
+        auto found = handles.find(location);
+        if (found != handles.end()) return found->second;
+        
+        TextureHandle handle = sprites.size();
+        handles.emplace(location, handle);
+        names.push_back(location);
+        sprites.emplace_back();
+        requested.push_back(0);
+        return handle;
+    }
+    
+    void decode();
+    void build_atlas();
+    void start_decoders() {
+        nextJob = 0;
+        decodedJobs = 0;
+        cancelled = false;
+        int threads = std::min<int>(jobs.size(), std::max(1u, std::thread::hardware_concurrency()));
+        for (int i = 0; i < threads; i++) {
+            decoders.emplace_back(&Assets::decode, this);
+        }
+    }
+    public:
+        static Assets &get()
+        {
+            static Assets ins;
+            return ins;
+        }
+        
+        // Returns the same handle for the same name; sprites are filled in once their texture loads
+        TextureHandle intern(const char *location) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return intern_locked(location);
+        }
+        std::string name(TextureHandle handle) {
+            std::lock_guard<std::mutex> lock(mutex);
+            return names[handle];
+        }
+        // Handles run from 0 to one less than this
+        int handle_count() {
+            std::lock_guard<std::mutex> lock(mutex);
+            return names.size();
+        }
+        // Hold while calling sprite() when other threads may intern or request textures
+        std::unique_lock<std::mutex> lock_sprites() {
+            return std::unique_lock<std::mutex>(mutex);
+        }
+        Sprite *sprite(TextureHandle handle) {
+            return &sprites[handle];
+        }
+        Sprite *white_sprite() {
+            return &white;
+        }
+        void add_texture(const char *location, const char *path) {
+            std::lock_guard<std::mutex> lock(mutex);
+            TextureHandle handle = intern_locked(location);
+            requested[handle] = 1;
+            jobs.push_back({ handle, path, nullptr });
+        }
+        // Queues a texture from "<location>.png" for streaming, unless it was loaded or queued before
+        void request(const char *location) {
+            std::lock_guard<std::mutex> lock(mutex);
+            TextureHandle handle = intern_locked(location);
+            if (requested[handle]) return;
+            requested[handle] = 1;
+            pendingStream.push_back(handle);
+        }
+        // Call every frame from the renderer's thread while streaming. Finishes the running
+        // load when its images are decoded, then starts decoding whatever was requested since.
+        // Returns whether everything requested so far is loaded.
+        bool update_streaming();
+        // Starts decoding a stage's images on worker threads and returns immediately
+        void begin_load(LoadStages stage);
+        // Returns the progress of the current load between 0 and 1. Once every image is
+        // decoded this uploads the atlas on the calling thread, which must own the renderer.
+        float poll_load();
+        // Blocking load
+        void load(LoadStages stage) {
+            begin_load(stage);
+            while (poll_load() < 1.0f) SDL_Delay(1);
+        }
+        // Abandons the current load: waits for the images being decoded and drops them.
+        // Call before quitting in the middle of a load, decoder threads can't outlive it.
+        void cancel_load();
+    private:
+        Assets() {}
+        ~Assets() {
+            cancel_load();
+        }
+    public:
+        Assets(Assets const&) = delete;
+        void operator = (Assets const&) = delete;    
+};
+
+namespace Vars {
+    inline Vec2f gravity = { 0.0f, 9.8f };
+    // Measured in radians
+    inline float gravity_angle() {
+        return Trig::atan2(-gravity.y, gravity.x);
+    }
+};
+
+struct CollisionData {
+    // This doesn't have to be exactly inside the object to collide with
+    Vec2f intersection_point;
+    bool collided;
+};
+
+struct Circle {
+    Vec2f position;
+    float radius;
+};
+
+// Axis-aligned bounding box in world coordinates
+struct AABB {
+    float minX, minY, maxX, maxY;
+    bool overlaps(const AABB &other) const {
+        return minX <= other.maxX && other.minX <= maxX &&
+               minY <= other.maxY && other.minY <= maxY;
+    }
+};
+
+
+// Collects textured quads for a whole frame and submits them with as few
+// SDL_RenderGeometry calls as possible, one per distinct texture
+class SpriteBatch {
+    std::vector<SDL_Vertex> vertices;
+    std::vector<SDL_Texture*> textures;
+    std::vector<int> indices, order;
+    public:
+        // Corners in clockwise order, already in screen space
+        void quad(const Sprite *sprite, const SDL_FPoint corners[4], SDL_Color color) {
+            if (sprite->texture == nullptr) return;
+            
+            // Cull against the viewport
+            float minX = corners[0].x, maxX = minX, minY = corners[0].y, maxY = minY;
+            for (int i = 1; i < 4; i++) {
+                minX = std::min(minX, corners[i].x); maxX = std::max(maxX, corners[i].x);
+                minY = std::min(minY, corners[i].y); maxY = std::max(maxY, corners[i].y);
+            }
+            if (maxX < 0 || maxY < 0 || minX > SCREEN_WIDTH || minY > SCREEN_HEIGHT) return;
+            
+            const SDL_FPoint uv[4] = {
+                { sprite->u0, sprite->v0 }, { sprite->u1, sprite->v0 },
+                { sprite->u1, sprite->v1 }, { sprite->u0, sprite->v1 }
+            };
+            for (int i = 0; i < 4; i++) {
+                vertices.push_back({ corners[i], color, uv[i] });
+            }
+            textures.push_back(sprite->texture);
+        }
+        int size() {
+            return textures.size();
+        }
+        void flush() {
+            int quads = textures.size();
+            if (quads == 0) return;
+            
+            // Group quads by texture, keeping submission order inside each group
+            order.resize(quads);
+            for (int i = 0; i < quads; i++) order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [this](int a, int b) {
+                return textures[a] < textures[b];
+            });
+            
+            int start = 0;
+            while (start < quads) {
+                SDL_Texture *texture = textures[order[start]];
+                indices.clear();
+                int end = start;
+                for (; end < quads && textures[order[end]] == texture; end++) {
+                    int v = order[end] * 4;
+                    for (int i : { 0, 1, 2, 0, 2, 3 }) indices.push_back(v + i);
+                }
+                SDL_RenderGeometry(renderer, texture, vertices.data(), vertices.size(), indices.data(), indices.size());
+                start = end;
+            }
+            vertices.clear();
+            textures.clear();
+        }
+};
+
+struct StaticLayer;
+
+// Static layer cache counters of the last frame
+struct StaticLayerStats {
+    // Chunk textures kept, and how many chunks were shown and drawn again into their texture
+    int cachedChunks = 0;
+    int chunksShown = 0;
+    int chunksRendered = 0;
+    size_t bytes = 0;
+};
+
+namespace Draw {
+    void color(float r, float g, float b);
+    // Batched sprite centered on (x, y)
+    void sprite(const Sprite *sprite, float x, float y, float w, float h);
+    // Batched sprite with its top left corner on (x, y), rotated clockwise around its center
+    void rotated_sprite(const Sprite *sprite, float x, float y, float width, float height, float angle);
+    // Submits everything batched so far
+    void flush();
+    void texture(SDL_Texture *tex, int x, int y, int w, int h);
+    void texture_uncentered(SDL_Texture *tex, int x, int y, int width, int height);
+    void rotated_texture(SDL_Texture *tex, int x, int y, int width, int height, float angle);
+    void rect_fill_uncentered(int x, int y, int w, int h);
+    void rect_fill(int x, int y, int w, int h);
+    void line(int x1, int y1, int x2, int y2);
+    // One pixel wide line drawn as a quad in the sprite batch, using the current color
+    void batched_line(float x1, float y1, float x2, float y2);
+    // Draws the static layer chunks the camera sees, from textures kept until a chunk changes
+    // when the renderer supports render targets, shape by shape otherwise
+    void static_layer(const StaticLayer &layer);
+    // Drops the cached chunk textures, for when the renderer lost its render targets
+    void reset_static_layer();
+    // What the static layer did in the latest frame, also recorded as profiler counters
+    StaticLayerStats static_layer_stats();
+};
+
+enum DrawKind {
+    DRAW_SPRITE,
+    DRAW_ROTATED_SPRITE,
+    DRAW_LINE
+};
+
+// One thing to draw, in world space. Moving things carry their previous step as well so the
+// renderer can interpolate without looking at the simulation.
+struct DrawItem {
+    DrawKind kind;
+    TextureHandle texture;
+    // Sprite position or line start, at the previous and at the latest step
+    Vec2f from, to;
+    // Line end, interpolated the same way
+    Vec2f endFrom, endTo;
+    float width, height, angle;
+};
+
+// Static shapes as draw items, bucketed by the square chunks of the world they reach into.
+// The simulation builds a new one whenever static geometry changes and shares it read-only
+// with the renderer, which keeps a texture of every chunk it shows until the chunk's hash changes.
+struct StaticLayer {
+    static const int CHUNK_SIZE = 512;
+    struct Chunk {
+        int x, y;
+        // Of everything drawn into the chunk, so rebuilding the layer keeps unchanged textures
+        unsigned long long hash;
+        // Range of chunkShapes
+        int first, count;
+    };
+    // Every static shape once, in draw order
+    std::vector<DrawItem> shapes;
+    // Indices into shapes, chunk after chunk
+    std::vector<int> chunkShapes;
+    std::vector<Chunk> chunks;
+    std::unordered_map<long long, int> chunkIndex;
+    
+    static long long key(int x, int y) {
+        return (long long) (((unsigned long long) (unsigned int) y << 32) | (unsigned int) x);
+    }
+    const Chunk *find(int x, int y) const {
+        auto found = chunkIndex.find(key(x, y));
+        return found != chunkIndex.end() ? &chunks[found->second] : nullptr;
+    }
+    static_assert(sizeof(DrawItem) == sizeof(DrawKind) + sizeof(TextureHandle) + sizeof(Vec2f) * 4 + sizeof(float) * 3,
+                  "chunk hashes read every byte of a DrawItem");
+    // Buckets the shapes, boxes holding the world bounds of each
+    void build(const std::vector<AABB> &boxes) {
+        // Lines and filtered sprite edges reach a little past the bounds
+        const float margin = 1;
+        float size = CHUNK_SIZE;
+        // (chunk y, chunk x, shape), so chunks come out in row order and shapes in draw order
+        std::vector<std::tuple<int, int, int>> entries;
+        for (int i = 0; i < (int) boxes.size(); i++) {
+            const AABB &b = boxes[i];
+            int x0 = (int) floor((b.minX - margin) / size), x1 = (int) floor((b.maxX + margin) / size);
+            int y0 = (int) floor((b.minY - margin) / size), y1 = (int) floor((b.maxY + margin) / size);
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    entries.emplace_back(y, x, i);
+                }
+            }
+        }
+        std::sort(entries.begin(), entries.end());
+        
+        chunkShapes.clear();
+        chunks.clear();
+        chunkIndex.clear();
+        for (auto &e : entries) {
+            int y = std::get<0>(e), x = std::get<1>(e);
+            if (chunks.empty() || chunks.back().x != x || chunks.back().y != y) {
+                chunkIndex[key(x, y)] = chunks.size();
+                chunks.push_back({ x, y, 14695981039346656037ull, (int) chunkShapes.size(), 0 });
+            }
+            chunkShapes.push_back(std::get<2>(e));
+            chunks.back().count++;
+        }
+        // FNV-1a over the items
+        for (auto &c : chunks) {
+            for (int i = c.first; i < c.first + c.count; i++) {
+                const unsigned char *bytes = (const unsigned char*) &shapes[chunkShapes[i]];
+                for (size_t k = 0; k < sizeof(DrawItem); k++) {
+                    c.hash = (c.hash ^ bytes[k]) * 1099511628211ull;
+                }
+            }
+        }
+    }
+};
+
+// Everything visible after a step, in draw order, plus the camera
+class RenderFrame {
+    public:
+        // Drawn first, underneath items
+        std::shared_ptr<const StaticLayer> statics;
+        std::vector<DrawItem> items;
+        Vec2f cameraFrom, cameraTo;
+        // Performance counter reading at which the simulation clock reached this step
+        Uint64 stepTime = 0;
+        
+        void clear() {
+            items.clear();
+        }
+        // alpha is the progress from the previous step to this one. The caller has to hold
+        // Assets::lock_sprites() if textures can be interned on another thread meanwhile.
+        void draw(float alpha) const {
+            Draw::color(0.1, 0.1, 0.85);
+            Draw::rect_fill_uncentered(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
+            Draw::color(1.0, 1.0, 1.0);
+            
+            Vec2f eye = cameraFrom;
+            eye.interpolate(cameraTo, alpha);
+            Projection::adjust_camera(eye.x, eye.y);
+            if (statics != nullptr) Draw::static_layer(*statics);
+            
+            Assets &assets = Assets::get();
+            for (auto &item : items) {
+                Vec2f p = item.from;
+                p.interpolate(item.to, alpha);
+                float ox = p.x, oy = p.y;
+                Projection::world_to_screen(ox, oy);
+                
+                switch (item.kind) {
+                    case DRAW_SPRITE:
+                        Draw::sprite(assets.sprite(item.texture), ox, oy, item.width, item.height);
+                        break;
+                    case DRAW_ROTATED_SPRITE:
+                        Draw::rotated_sprite(assets.sprite(item.texture), ox, oy, item.width, item.height, item.angle);
+                        break;
+                    case DRAW_LINE: {
+                        Vec2f end = item.endFrom;
+                        end.interpolate(item.endTo, alpha);
+                        float ex = end.x, ey = end.y;
+                        Projection::world_to_screen(ex, ey);
+                        Draw::batched_line(ox, oy, ex, ey);
+                        break;
+                    }
+                }
+            }
+            Draw::flush();
+        }
+};
+
+// Hands the newest of a stream of values from one writer thread to one reader thread without
+// locks. The writer fills back() and publishes it, the reader takes whatever was published last.
+// Neither ever waits for the other, a slow reader just skips values.
+template <typename T>
+class TripleBuffer {
+    static const int FRESH = 4;
+    T slots[3];
+    // Slot between the two sides, with FRESH set when the writer put it there
+    std::atomic<int> middle{ 1 };
+    int back = 0, front = 2;
+    public:
+        T &back_buffer() {
+            return slots[back];
+        }
+        void publish() {
+            back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+        }
+        // The newest published value, or the same as last time when nothing new arrived
+        const T &latest() {
+            if (middle.load(std::memory_order_relaxed) & FRESH) {
+                front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
+            }
+            return slots[front];
+        }
+};
+
+struct PoolStats {
+    int live = 0;
+    // Most objects alive at once
+    int highWater = 0;
+    int capacity = 0;
+    size_t bytesReserved = 0;
+};
+
+// Typed object pool handing out slots from contiguous chunks.
+// Addresses stay stable for the object's lifetime and freed slots are reused first.
+template <typename T>
+class ObjectPool {
+    static const int CHUNK_SIZE = 256;
+    union Slot {
+        Slot *next;
+        alignas(T) unsigned char storage[sizeof(T)];
+    };
+    std::vector<std::unique_ptr<Slot[]>> chunks;
+    Slot *freeList = nullptr;
+    PoolStats stats;
+    public:
+        ObjectPool() {}
+        ObjectPool(ObjectPool const&) = delete;
+        void operator = (ObjectPool const&) = delete;
+        
+        template <typename... Args>
+        T *create(Args&&... args) {
+            if (freeList == nullptr) {
+                chunks.emplace_back(new Slot[CHUNK_SIZE]);
+                Slot *chunk = chunks.back().get();
+                // Thread the new chunk so slots come out in address order
+                for (int i = CHUNK_SIZE - 1; i >= 0; i--) {
+                    chunk[i].next = freeList;
+                    freeList = &chunk[i];
+                }
+                stats.capacity += CHUNK_SIZE;
+                stats.bytesReserved += sizeof(Slot) * CHUNK_SIZE;
+            }
+            Slot *slot = freeList;
+            freeList = slot->next;
+            
+            stats.live++;
+            stats.highWater = std::max(stats.highWater, stats.live);
+            return new (slot->storage) T(std::forward<Args>(args)...);
+        }
+        void destroy(T *object) {
+            object->~T();
+            Slot *slot = (Slot*) object;
+            slot->next = freeList;
+            freeList = slot;
+            stats.live--;
+        }
+        PoolStats get_stats() {
+            return stats;
+        }
+};
+
+// Concrete type of a world object, used to dispatch collisions without string comparisons
+enum ShapeType {
+    SHAPE_NONE,
+    SHAPE_BALL,
+    SHAPE_LINE,
+    SHAPE_RECTANGLE,
+    SHAPE_PENDULUM,
+    SHAPE_COUNT
+};
+
+// What every world object is: its shape, where it is and where it sits in the world's lists.
+// Nothing here is virtual, code that needs the concrete shape switches on type, so static
+// shapes carry no vtable and no motion state.
+class WorldObject {
+    public:
+        Vec2f position;
+        // Position at the start of the current physics step, used for render interpolation
+        Vec2f previousPosition;
+    
+        int index = 0;
+        // Position inside the dense list of its kind, the BallStore for balls, -1 when not listed
+        int slot = -1;
+        ShapeType type = SHAPE_NONE;
+        // Shape of the streamed level this object was spawned from, -1 when created by code
+        int levelShape = -1;
+        WorldObject(ShapeType type) {
+            this->type = type;
+            position.set_zero();
+            previousPosition.set_zero();
+        }
+        void place(float x, float y) {
+             position.x = x;
+             position.y = y;
+             // Teleports shouldn't be interpolated
+             previousPosition = position;
+        }
+        void moveX(float x) {
+             position.x += x;
+        }
+        void moveY(float y) {
+             position.y += y;
+        }
+        Vec2f interpolated(float alpha) {
+             Vec2f result = previousPosition;
+             return result.interpolate(position, alpha);
+        }
+        // Dispatch on type, defined once every shape is
+        AABB bounds();
+        // Appends what the object looks like now
+        void draw(std::vector<DrawItem> &out);
+};
+
+// Motion state, carried only by objects that move
+struct Kinematics {
+    float mass;
+    float resistance = 0.85f;
+    Vec2f vel = { 0, 0 }, acceleration = { 0, 0 };
+    // What the body pushed against hardest in the last step
+    WorldObject *colliding = nullptr;
+};
+
+class Line;
+class Rectangle;
+
+class Ball : public WorldObject, public Kinematics {
+    TextureHandle ballSprite;
+    public: 
+        static constexpr float FALL_DEPTH = 50000, RESPAWN_Y = -400;
+        float radius;
+        // Seconds spent within the sleep distance of restAnchor
+        float restTime = 0;
+        Vec2f restAnchor;
+        bool sleeping = false;
+        bool canSleep = true;
+        // Balls sharing a group other than 0 pass through each other, like the links of one rope
+        int group = 0;
+        // Moved rather than travelled during the current step, so there is no path to sweep
+        // and nothing to interpolate along
+        bool teleported = false;
+        // Constraints the ball takes part in
+        int joints = 0;
+        // Static shapes around the ball, valid while its bounds stay inside staticReach
+        // and the static tree hasn't changed since staticsVersion
+        std::vector<int> nearbyStatics;
+        AABB staticReach;
+        int staticsVersion = -1;
+        Ball(TextureHandle sprite, float radius, float mass) : WorldObject(SHAPE_BALL) {
+            this->mass = mass;
+            this->radius = radius;
+            this->ballSprite = sprite;
+        }
+        Ball(const char *spriteName, float radius, float mass) : Ball(Assets::get().intern(spriteName), radius, mass) {}
+        TextureHandle get_sprite() {
+            return ballSprite;
+        }   
+        void jump(float force, WorldObject *o);
+        void update(float timeTook);
+        // Where drawing interpolates from
+        Vec2f drawn_from() {
+            return teleported ? position : previousPosition;
+        }
+        // Balls that fell out of the world come back from above it. Returns whether it did.
+        bool respawn_if_fallen() {
+            if (position.y < radius + FALL_DEPTH) return false;
+            place(position.x, RESPAWN_Y);
+            teleported = true;
+            restTime = 0;
+            return true;
+        }
+        void draw(std::vector<DrawItem> &out);
+        // Covers the whole motion of the last step so swept queries find what was passed through
+        AABB bounds() {
+            return { std::min(position.x, previousPosition.x) - radius, std::min(position.y, previousPosition.y) - radius,
+                     std::max(position.x, previousPosition.x) + radius, std::max(position.y, previousPosition.y) + radius };
+        }
+    
+    CollisionData collision(WorldObject *object);
+    CollisionData collision(Line *line);
+    CollisionData collision(Rectangle *rectangle);
+    CollisionData collision(Ball *other);
+};
+// Integrates packed ball state, the same math as Ball::update minus the respawn,
+// which BallStore::scatter does per ball since it moves the ball rather than integrating it
+inline void integrate_balls(float *x, float *y, float *vx, float *vy, float *ax, float *ay,
+                            const float *resistance, int count,
+                            float gx, float gy, float timeTook)
+{
+    int i = 0;
+#if defined(__AVX2__)
+    const __m256 vgx = _mm256_set1_ps(gx), vgy = _mm256_set1_ps(gy);
+    const __m256 dt = _mm256_set1_ps(timeTook);
+    const __m256 rest = _mm256_set1_ps(0.01f);
+    for (; i + 8 <= count; i += 8) {
+        __m256 px = _mm256_loadu_ps(x + i), py = _mm256_loadu_ps(y + i);
+        __m256 vlx = _mm256_loadu_ps(vx + i), vly = _mm256_loadu_ps(vy + i);
+        __m256 r = _mm256_loadu_ps(resistance + i);
+        
+        __m256 alx = _mm256_sub_ps(vgx, _mm256_mul_ps(vlx, r));
+        __m256 aly = _mm256_sub_ps(vgy, _mm256_mul_ps(vly, r));
+        vlx = _mm256_add_ps(vlx, _mm256_mul_ps(alx, dt));
+        vly = _mm256_add_ps(vly, _mm256_mul_ps(aly, dt));
+        px = _mm256_add_ps(px, _mm256_mul_ps(vlx, dt));
+        py = _mm256_add_ps(py, _mm256_mul_ps(vly, dt));
+        
+        __m256 len2 = _mm256_add_ps(_mm256_mul_ps(vlx, vlx), _mm256_mul_ps(vly, vly));
+        __m256 resting = _mm256_cmp_ps(len2, rest, _CMP_LT_OQ);
+        vlx = _mm256_andnot_ps(resting, vlx);
+        vly = _mm256_andnot_ps(resting, vly);
+        
+        _mm256_storeu_ps(x + i, px); _mm256_storeu_ps(y + i, py);
+        _mm256_storeu_ps(vx + i, vlx); _mm256_storeu_ps(vy + i, vly);
+        _mm256_storeu_ps(ax + i, alx); _mm256_storeu_ps(ay + i, aly);
+    }
+#elif defined(__SSE2__)
+    const __m128 vgx = _mm_set1_ps(gx), vgy = _mm_set1_ps(gy);
+    const __m128 dt = _mm_set1_ps(timeTook);
+    const __m128 rest = _mm_set1_ps(0.01f);
+    for (; i + 4 <= count; i += 4) {
+        __m128 px = _mm_loadu_ps(x + i), py = _mm_loadu_ps(y + i);
+        __m128 vlx = _mm_loadu_ps(vx + i), vly = _mm_loadu_ps(vy + i);
+        __m128 r = _mm_loadu_ps(resistance + i);
+        
+        __m128 alx = _mm_sub_ps(vgx, _mm_mul_ps(vlx, r));
+        __m128 aly = _mm_sub_ps(vgy, _mm_mul_ps(vly, r));
+        vlx = _mm_add_ps(vlx, _mm_mul_ps(alx, dt));
+        vly = _mm_add_ps(vly, _mm_mul_ps(aly, dt));
+        px = _mm_add_ps(px, _mm_mul_ps(vlx, dt));
+        py = _mm_add_ps(py, _mm_mul_ps(vly, dt));
+        
+        __m128 len2 = _mm_add_ps(_mm_mul_ps(vlx, vlx), _mm_mul_ps(vly, vly));
+        __m128 resting = _mm_cmplt_ps(len2, rest);
+        vlx = _mm_andnot_ps(resting, vlx);
+        vly = _mm_andnot_ps(resting, vly);
+        
+        _mm_storeu_ps(x + i, px); _mm_storeu_ps(y + i, py);
+        _mm_storeu_ps(vx + i, vlx); _mm_storeu_ps(vy + i, vly);
+        _mm_storeu_ps(ax + i, alx); _mm_storeu_ps(ay + i, aly);
+    }
+#endif
+    // Scalar remainder
+    for (; i < count; i++) {
+        ax[i] = gx - vx[i] * resistance[i];
+        ay[i] = gy - vy[i] * resistance[i];
+        
+        vx[i] += ax[i] * timeTook;
+        vy[i] += ay[i] * timeTook;
+        
+        x[i] += vx[i] * timeTook;
+        y[i] += vy[i] * timeTook;
+        
+        if (vx[i] * vx[i] + vy[i] * vy[i] < 0.01f) {
+            vx[i] = 0;
+            vy[i] = 0;
+        }
+    }
+}
+
+// Structure-of-arrays storage of ball kinematics.
+// Collision response and rendering still go through the Ball objects, so the
+// store gathers their state before integrating and scatters the results back.
+class BallStore {
+    std::vector<Ball*> balls;
+    std::vector<float> x, y, vx, vy, ax, ay, resistance;
+    // Awake balls occupy the first awakeCount slots, sleeping ones the rest
+    int awakeCount = 0;
+    
+    void move_slot(int from, int to) {
+        if (from == to) return;
+        balls[to] = balls[from];
+        balls[to]->slot = to;
+        for (auto *v : { &x, &y, &vx, &vy, &ax, &ay, &resistance }) {
+            (*v)[to] = (*v)[from];
+        }
+    }
+    void swap_slots(int a, int b) {
+        if (a == b) return;
+        std::swap(balls[a], balls[b]);
+        balls[a]->slot = a;
+        balls[b]->slot = b;
+        for (auto *v : { &x, &y, &vx, &vy, &ax, &ay, &resistance }) {
+            std::swap((*v)[a], (*v)[b]);
+        }
+    }
+    public:
+        int size() {
+            return balls.size();
+        }
+        int awake_count() {
+            return awakeCount;
+        }
+        void add(Ball *ball) {
+            ball->slot = balls.size();
+            balls.push_back(ball);
+            
+            x.push_back(0); y.push_back(0);
+            vx.push_back(0); vy.push_back(0);
+            ax.push_back(0); ay.push_back(0);
+            resistance.push_back(ball->resistance);
+            
+            ball->sleeping = false;
+            swap_slots(ball->slot, awakeCount++);
+        }
+        void remove(Ball *ball) {
+            int s = ball->slot, last = balls.size() - 1;
+            if (s < 0) return;
+            
+            // Keep both partitions dense
+            if (s < awakeCount) {
+                move_slot(awakeCount - 1, s);
+                move_slot(last, awakeCount - 1);
+                awakeCount--;
+            } else {
+                move_slot(last, s);
+            }
+            for (auto *v : { &x, &y, &vx, &vy, &ax, &ay, &resistance }) {
+                v->pop_back();
+            }
+            balls.pop_back();
+            ball->slot = -1;
+        }
+        void sleep(Ball *ball) {
+            if (ball->sleeping || ball->slot < 0) return;
+            swap_slots(ball->slot, --awakeCount);
+            ball->sleeping = true;
+            ball->vel.set_zero();
+        }
+        void wake(Ball *ball) {
+            ball->restTime = 0;
+            if (!ball->sleeping || ball->slot < 0) return;
+            swap_slots(ball->slot, awakeCount++);
+            ball->sleeping = false;
+        }
+        void wake_all() {
+            while (awakeCount < (int) balls.size()) {
+                wake(balls[awakeCount]);
+            }
+        }
+        // Only awake balls are gathered, integrated and scattered
+        void gather() {
+            for (int i = 0; i < awakeCount; i++) {
+                Ball *b = balls[i];
+                x[i] = b->position.x; y[i] = b->position.y;
+                vx[i] = b->vel.x; vy[i] = b->vel.y;
+                resistance[i] = b->resistance;
+            }
+        }
+        void integrate(float timeTook, Vec2f gravity) {
+            integrate_balls(x.data(), y.data(), vx.data(), vy.data(), ax.data(), ay.data(),
+                            resistance.data(), awakeCount,
+                            gravity.x * 60, gravity.y * 60, timeTook);
+        }
+        void scatter() {
+            for (int i = 0; i < awakeCount; i++) {
+                Ball *b = balls[i];
+                b->position.x = x[i]; b->position.y = y[i];
+                b->vel.x = vx[i]; b->vel.y = vy[i];
+                b->acceleration.x = ax[i]; b->acceleration.y = ay[i];
+                b->respawn_if_fallen();
+            }
+        }
+        Ball *at(int slot) {
+            return balls[slot];
+        }
+        // Every ball, awake ones first
+        const std::vector<Ball*> &all() {
+            return balls;
+        }
+        // Start of a step, sleeping balls included so their swept bounds collapse
+        void save_previous_positions() {
+            for (auto &b : balls) {
+                b->previousPosition = b->position;
+                b->teleported = false;
+            }
+        }
+};
+
+class Line : public WorldObject {
+    public:
+        Vec2f endPosition;
+        Vec2f gradient, normal;
+        int side = 0;  
+        Line(Vec2f v1, Vec2f v2) : WorldObject(SHAPE_LINE) {
+            place(v1.x, v1.y);
+            this->endPosition = v2;
+        }
+        // Caches the gradient and normal, lines don't move once placed
+        void bake();
+        void draw(std::vector<DrawItem> &out);
+        AABB bounds() {
+            return { std::min(position.x, endPosition.x), std::min(position.y, endPosition.y),
+                     std::max(position.x, endPosition.x), std::max(position.y, endPosition.y) };
+        }
+};
+
+class Rectangle : public WorldObject {
+    TextureHandle rectangleSprite;
+    public:
+        float width;
+        float height;
+        float angle;
+        // The angle is in degrees
+        Rectangle(TextureHandle sprite, float width, float height, float angle) : WorldObject(SHAPE_RECTANGLE) {
+            this->width = width;
+            this->height = height;
+            this->angle = Utils::radians(angle);
+            this->rectangleSprite = sprite;
+        }
+        Rectangle(const char *textureName, float width, float height, float angle)
+            : Rectangle(Assets::get().intern(textureName), width, height, angle) {}
+        TextureHandle get_sprite() {
+            return rectangleSprite;
+        }
+        // Frame cached by bake(), rectangles don't move once placed
+        Vec2f center;
+        float cosAngle = 1, sinAngle = 0;
+        AABB box;
+        
+        void draw(std::vector<DrawItem> &out);
+        // Must run again whenever the position or angle changes
+        void bake() {
+            center = position;
+            center.add(width / 2, height / 2);
+            cosAngle = cos(angle);
+            sinAngle = sin(angle);
+            
+            // Rotation happens around the center, so extend the half extents by the rotated axes
+            float c = fabs(cosAngle), s = fabs(sinAngle);
+            float ex = (width * c + height * s) / 2;
+            float ey = (width * s + height * c) / 2;
+            box = { center.x - ex, center.y - ey, center.x + ex, center.y + ey };
+        }
+        // Into the rectangle's frame, where it is axis aligned around the origin
+        Vec2f to_local(Vec2f p) {
+            float dx = p.x - center.x, dy = p.y - center.y;
+            return { dx * cosAngle + dy * sinAngle, dy * cosAngle - dx * sinAngle };
+        }
+        Vec2f to_world(Vec2f p) {
+            return { center.x + p.x * cosAngle - p.y * sinAngle, center.y + p.x * sinAngle + p.y * cosAngle };
+        }
+        // Rotates a direction out of the rectangle's frame
+        Vec2f direction_to_world(Vec2f d) {
+            return { d.x * cosAngle - d.y * sinAngle, d.x * sinAngle + d.y * cosAngle };
+        }
+        AABB bounds() {
+            return box;
+        }
+};
+
+// Knob hanging from a fixed pivot. The knob is an ordinary ball kept length away from
+// the pivot by a pin constraint, so it swings, collides and sleeps like any other ball.
+class Pendulum : public WorldObject {
+    public:
+       float length;
+       Ball *knob;
+       Pendulum(float length, Ball *knob) : WorldObject(SHAPE_PENDULUM) {
+           this->length = length;
+           this->knob = knob;
+       }
+       void add(std::vector<WorldObject*> &vec) {
+           knob->index = vec.size();
+           vec.push_back(knob);
+       }
+       // Puts the pivot at pos and the knob level with it on the left, where it starts swinging from
+       void place(Vec2f pos) {
+           WorldObject::place(pos.x, pos.y);
+           knob->place(pos.x - length, pos.y);
+       }
+       AABB bounds() {
+           return { std::min(position.x, knob->position.x), std::min(position.y, knob->position.y),
+                    std::max(position.x, knob->position.x), std::max(position.y, knob->position.y) };
+       }
+};
+
+inline AABB WorldObject::bounds() {
+    switch (type) {
+        case SHAPE_BALL: return ((Ball*) this)->bounds();
+        case SHAPE_LINE: return ((Line*) this)->bounds();
+        case SHAPE_RECTANGLE: return ((Rectangle*) this)->bounds();
+        case SHAPE_PENDULUM: return ((Pendulum*) this)->bounds();
+        default: return { position.x, position.y, position.x, position.y };
+    }
+}
+
+// Pool of one kind of object plus a dense list of the live ones, so systems that act on
+// that kind scan an array instead of filtering the whole object list. Removal swaps the
+// last object into the freed slot. Components stay inside their objects: the per-step loops
+// that would gain from separate component arrays are a few percent of a step, see the
+// layout suite of aluminium-bench.
+template <typename T>
+class Archetype {
+    ObjectPool<T> pool;
+    std::vector<T*> items;
+    public:
+        template <typename... Args>
+        T *create(Args&&... args) {
+            T *object = pool.create(std::forward<Args>(args)...);
+            object->slot = items.size();
+            items.push_back(object);
+            return object;
+        }
+        void destroy(T *object) {
+            T *last = items.back();
+            items[object->slot] = last;
+            last->slot = object->slot;
+            items.pop_back();
+            pool.destroy(object);
+        }
+        int size() {
+            return items.size();
+        }
+        T *at(int i) {
+            return items[i];
+        }
+        const std::vector<T*> &all() {
+            return items;
+        }
+        PoolStats get_stats() {
+            return pool.get_stats();
+        }
+};
+
+// Time of impact queries for a circle moving from p0 to p1.
+// t is the fraction of the motion at first contact. A circle that already
+// overlaps at p0 reports no impact, the contact kernels push it out instead.
+namespace Sweep {
+    // Point p0 moving by d against a circle of radius r around c
+    inline bool ray_circle(Vec2f p0, Vec2f d, Vec2f c, float r, float &t) {
+        Vec2f m = { p0.x - c.x, p0.y - c.y };
+        float outside = m.len2() - r * r;
+        float b = m.dot_prod(d);
+        if (outside <= 0 || b >= 0) return false;
+
+        float a = d.len2();
+        float disc = b * b - a * outside;
+        if (disc < 0) return false;
+
+        float hit = (-b - sqrt(disc)) / a;
+        if (hit > 1) return false;
+        t = hit;
+        return true;
+    }
+    // Point p0 moving by d against the box [-ex, ex] x [-ey, ey]
+    inline bool ray_box(Vec2f p0, Vec2f d, float ex, float ey, float &t) {
+        const float p[2] = { p0.x, p0.y }, v[2] = { d.x, d.y }, e[2] = { ex, ey };
+        float enter = 0, leave = 1;
+        for (int k = 0; k < 2; k++) {
+            if (v[k] == 0) {
+                if (fabs(p[k]) > e[k]) return false;
+                continue;
+            }
+            float t1 = (-e[k] - p[k]) / v[k], t2 = (e[k] - p[k]) / v[k];
+            if (t1 > t2) std::swap(t1, t2);
+            enter = std::max(enter, t1);
+            leave = std::min(leave, t2);
+            if (enter > leave) return false;
+        }
+        t = enter;
+        return true;
+    }
+    inline bool circle_segment(Vec2f p0, Vec2f p1, float radius, Vec2f a, Vec2f b, float &t) {
+        Vec2f d = { p1.x - p0.x, p1.y - p0.y };
+        Vec2f e = { b.x - a.x, b.y - a.y };
+        Vec2f m = { p0.x - a.x, p0.y - a.y };
+        float len = e.len2();
+        if (len == 0) return ray_circle(p0, d, a, radius, t);
+
+        float projected = m.dot_prod(e);
+        float along = Utils::another_clamp(projected, 0, len) / len;
+        Vec2f closest = a;
+        closest.interpolate(b, along);
+        if (closest.dst2(p0) <= radius * radius) return false;
+
+        // The swept circle hits the segment's capsule: two offset faces and two end caps
+        bool hit = false;
+        float best = 1, tc;
+        Vec2f n = e.perpendicular(1);
+        n.multiply(1 / sqrt(len));
+        float s0 = m.x * n.x + m.y * n.y;
+        float s1 = s0 + d.dot_prod(n);
+        float side = s0 > 0 ? radius : -radius;
+        if (fabs(s0) > radius && (s1 - side) * (s0 - side) <= 0) {
+            tc = (s0 - side) / (s0 - s1);
+            float u = ((m.x + d.x * tc) * e.x + (m.y + d.y * tc) * e.y) / len;
+            if (u >= 0 && u <= 1) {
+                best = tc;
+                hit = true;
+            }
+        }
+        if (ray_circle(p0, d, a, radius, tc) && tc <= best) { best = tc; hit = true; }
+        if (ray_circle(p0, d, b, radius, tc) && tc <= best) { best = tc; hit = true; }
+
+        if (hit) t = best;
+        return hit;
+    }
+    inline bool circle_rectangle(Vec2f p0, Vec2f p1, float radius, Rectangle *rect, float &t) {
+        // Work in the rectangle's frame, where it is axis aligned around the origin
+        Vec2f l0 = rect->to_local(p0);
+        Vec2f l1 = rect->to_local(p1);
+        float hw = rect->width / 2, hh = rect->height / 2;
+        Vec2f d = { l1.x - l0.x, l1.y - l0.y };
+
+        float cx = l0.x, cy = l0.y;
+        Utils::clamp(cx, -hw, hw);
+        Utils::clamp(cy, -hh, hh);
+        Vec2f gap = { l0.x - cx, l0.y - cy };
+        if (gap.len2() <= radius * radius) return false;
+
+        // The rounded rectangle is two boxes grown along one axis each plus four corner circles
+        bool hit = false;
+        float best = 1, tc;
+        if (ray_box(l0, d, hw + radius, hh, tc) && tc <= best) { best = tc; hit = true; }
+        if (ray_box(l0, d, hw, hh + radius, tc) && tc <= best) { best = tc; hit = true; }
+        const float corners[4][2] = { { -hw, -hh }, { hw, -hh }, { hw, hh }, { -hw, hh } };
+        for (auto &corner : corners) {
+            if (ray_circle(l0, d, Vec2f{ corner[0], corner[1] }, radius, tc) && tc <= best) {
+                best = tc;
+                hit = true;
+            }
+        }
+        if (hit) t = best;
+        return hit;
+    }
+    // Both circles move during the step, so the query runs on their relative motion
+    inline bool circle_circle(Vec2f p0, Vec2f p1, float radius, Vec2f q0, Vec2f q1, float otherRadius, float &t) {
+        return ray_circle(p0 - q0, (p1 - p0) - (q1 - q0), Vec2f{ 0, 0 }, radius + otherRadius, t);
+    }
+};
+
+// Contact found by the narrow phase. Balls touch anything at a single point, so one normal
+// and depth describe it; the solver fills in the rest before it runs.
+struct Manifold {
+    // Pairs start from a ball, b is a ball too when is_dynamic(b->type)
+    Ball *a;
+    WorldObject *b;
+    // From a towards b
+    Vec2f normal;
+    float depth;
+    // Positions when the contact was found, the depth left later follows from how far they moved
+    Vec2f startA, startB;
+    float inverseMassA, inverseMassB;
+    // Normal speed the solver aims for, above 0 when the bodies bounce apart
+    float target;
+    // Accumulated normal impulse, started from the same pair's impulse of the previous step
+    float impulse;
+};
+
+// Narrow phase for one ordered pair. Fills in the normal and depth and returns whether
+// they collided, without moving either body.
+typedef bool (*ContactKernel)(WorldObject *a, WorldObject *b, Manifold &m);
+
+// Maps a shape tag to its class
+template <ShapeType T> struct ShapeClass { typedef WorldObject type; };
+template <> struct ShapeClass<SHAPE_BALL> { typedef Ball type; };
+template <> struct ShapeClass<SHAPE_LINE> { typedef Line type; };
+template <> struct ShapeClass<SHAPE_RECTANGLE> { typedef Rectangle type; };
+template <> struct ShapeClass<SHAPE_PENDULUM> { typedef Pendulum type; };
+
+// Specialize with a static collide(A*, B*, Manifold&) to make a pair of shapes collide
+template <ShapeType A, ShapeType B>
+struct Contact {
+    static constexpr bool defined = false;
+};
+
+template <>
+struct Contact<SHAPE_BALL, SHAPE_LINE> {
+    static constexpr bool defined = true;
+    static bool collide(Ball *ball, Line *line, Manifold &m) {
+        CollisionData dat = ball->collision(line);
+        if (!dat.collided) return false;
+        
+        Vec2f toLine = dat.intersection_point - ball->position;
+        float dst = toLine.len();
+        if (dst > 0) {
+            m.normal = toLine * (1 / dst);
+        } else {
+            // A center exactly on the line has no direction to it, so leave the way it came from
+            m.normal = line->normal;
+            if (m.normal.dot_prod(ball->vel) < 0) m.normal = -m.normal;
+        }
+        m.depth = ball->radius - dst;
+        return true;
+    }
+};
+
+template <>
+struct Contact<SHAPE_BALL, SHAPE_RECTANGLE> {
+    static constexpr bool defined = true;
+    static bool collide(Ball *ball, Rectangle *r, Manifold &m) {
+        CollisionData dat = ball->collision(r);
+        if (!dat.collided) return false;
+        
+        // Decided in local space, the round trip to world space leaves an inside center a
+        // rounding error away from itself
+        Vec2f local = r->to_local(ball->position);
+        if (fabs(local.x) >= r->width / 2 || fabs(local.y) >= r->height / 2) {
+            Vec2f p = dat.intersection_point;
+            float dst = ball->position.dst(p);
+            m.normal = dst > 0 ? (p - ball->position) * (1 / dst) : -r->direction_to_world(local.normalized());
+            m.depth = ball->radius - dst;
+            return true;
+        }
+        
+        // The center ended up inside the rectangle. Leave through the face on the side the
+        // ball came from, or the closest face when it already started inside.
+        Vec2f came = r->to_local(ball->previousPosition);
+        float outsideX = fabs(came.x) - r->width / 2;
+        float outsideY = fabs(came.y) - r->height / 2;
+        
+        Vec2f side = local;
+        bool throughX = r->width / 2 - fabs(local.x) < r->height / 2 - fabs(local.y);
+        if (outsideX > 0 || outsideY > 0) {
+            side = came;
+            throughX = outsideX > outsideY;
+        }
+        
+        // Distance from the center to the chosen face
+        Vec2f out = { 0, 0 };
+        float depth = 0;
+        if (throughX) {
+            out.x = side.x < 0 ? -1 : 1;
+            depth = r->width / 2 - out.x * local.x;
+        } else {
+            out.y = side.y < 0 ? -1 : 1;
+            depth = r->height / 2 - out.y * local.y;
+        }
+        m.normal = -r->direction_to_world(out);
+        m.depth = depth + ball->radius;
+        return true;
+    }
+};
+
+template <>
+struct Contact<SHAPE_BALL, SHAPE_BALL> {
+    static constexpr bool defined = true;
+    static bool collide(Ball *ball, Ball *ball2, Manifold &m) {
+        CollisionData dat = ball->collision(ball2);
+        if (!dat.collided) return false;
+        
+        Vec2f between = ball2->position - ball->position;
+        float dst = between.len();
+        // Coincident centers have no normal, so they are pushed apart vertically
+        m.normal = dst > 0 ? between * (1 / dst) : Vec2f{ 0, 1 };
+        m.depth = ball->radius + ball2->radius - dst;
+        return true;
+    }
+};
+
+template <ShapeType A, ShapeType B>
+bool dispatch_contact(WorldObject *a, WorldObject *b, Manifold &m) {
+    return Contact<A, B>::collide((typename ShapeClass<A>::type*) a, (typename ShapeClass<B>::type*) b, m);
+}
+template <ShapeType A, ShapeType B>
+constexpr ContactKernel contact_kernel() {
+    if constexpr (Contact<A, B>::defined) return dispatch_contact<A, B>;
+    else return nullptr;
+}
+
+typedef std::array<std::array<ContactKernel, SHAPE_COUNT>, SHAPE_COUNT> ContactTable;
+
+template <size_t A, size_t... B>
+constexpr std::array<ContactKernel, SHAPE_COUNT> contact_row(std::index_sequence<B...>) {
+    return {{ contact_kernel<(ShapeType) A, (ShapeType) B>()... }};
+}
+template <size_t... A>
+constexpr ContactTable contact_table(std::index_sequence<A...>) {
+    return {{ contact_row<A>(std::make_index_sequence<SHAPE_COUNT>{})... }};
+}
+template <size_t A, size_t... B>
+constexpr bool contact_row_defined(std::index_sequence<B...>) {
+    return (Contact<(ShapeType) A, (ShapeType) B>::defined || ...);
+}
+template <size_t... A>
+constexpr std::array<bool, SHAPE_COUNT> contact_queries(std::index_sequence<A...>) {
+    return {{ contact_row_defined<A>(std::make_index_sequence<SHAPE_COUNT>{})... }};
+}
+
+// Shapes moved by contact kernels; contacts only conflict when they share one of these
+constexpr bool is_dynamic(ShapeType type) {
+    return type == SHAPE_BALL;
+}
+
+// Shapes that never move once placed. They are baked into the StaticTree instead of the spatial hash.
+constexpr bool is_static(ShapeType type) {
+    return type == SHAPE_LINE || type == SHAPE_RECTANGLE;
+}
+
+// Pair kernels indexed by [first shape][second shape], nullptr when the pair doesn't interact
+constexpr ContactTable contactTable = contact_table(std::make_index_sequence<SHAPE_COUNT>{});
+// Whether a shape has any kernel as the first of a pair, i.e. needs broad phase queries
+constexpr std::array<bool, SHAPE_COUNT> contactQueries = contact_queries(std::make_index_sequence<SHAPE_COUNT>{});
+static_assert(!contactQueries[SHAPE_LINE] && !contactQueries[SHAPE_RECTANGLE] && !contactQueries[SHAPE_PENDULUM],
+              "contacts are solved as moving the ball they start from");
+
+// Level streaming counters
+struct StreamStats {
+    int activeChunks = 0;
+    // Static level shapes currently spawned
+    int streamedShapes = 0;
+    int chunkLoads = 0;
+    int chunkUnloads = 0;
+};
+
+struct CollisionStats {
+    // Candidate pairs that reached the narrow phase
+    int pairsTested = 0;
+    // Candidate pairs that actually intersected
+    int pairsCollided = 0;
+    int sleepingBalls = 0;
+    // Fast balls stopped at a time of impact
+    int sweptBalls = 0;
+};
+
+// Time spent in each contact kernel during one step, only measured while profiling
+struct ContactTimes {
+    Uint64 ticks[SHAPE_COUNT][SHAPE_COUNT] = {};
+    
+    void add(const ContactTimes &other) {
+        for (int a = 0; a < SHAPE_COUNT; a++) {
+            for (int b = 0; b < SHAPE_COUNT; b++) ticks[a][b] += other.ticks[a][b];
+        }
+    }
+};
+
+// Trace names of the contact kernels, indexed like contactTable
+const char *const contactNames[SHAPE_COUNT][SHAPE_COUNT] = {
+    { "", "", "", "", "" },
+    { "", "ball-ball us", "ball-line us", "ball-rectangle us", "ball-pendulum us" },
+    { "", "line-ball us", "line-line us", "line-rectangle us", "line-pendulum us" },
+    { "", "rectangle-ball us", "rectangle-line us", "rectangle-rectangle us", "rectangle-pendulum us" },
+    { "", "pendulum-ball us", "pendulum-line us", "pendulum-rectangle us", "pendulum-pendulum us" },
+};
+
+// Accumulated time spent in each phase of Aluminium::update, in seconds
+struct PhaseTimings {
+    double integration = 0;
+    double constraints = 0;
+    double camera = 0;
+    double broadPhase = 0;
+    double narrowPhase = 0;
+    int steps = 0;
+};
+
+// Uniform spatial hash used as the collision broad phase.
+// Objects are bucketed by the grid cells their bounds cover, and the buckets are
+// rebuilt with a counting sort every frame so no per-cell allocations happen.
+// Objects spanning too many cells (e.g. long beams) are kept in a separate list instead.
+class SpatialHash {
+    float cellSize;
+    int maxCellsPerObject;
+    
+    std::vector<AABB> boxes;
+    std::vector<int> stamps;
+    int stamp = 0;
+    
+    std::vector<int> oversized;
+    std::vector<std::pair<unsigned int, int>> entries;
+    std::vector<int> bucketStart, bucketFill, bucketItems;
+    unsigned int bucketMask = 0;
+    
+    int cell(float v) {
+        return (int) floor(v / cellSize);
+    }
+    unsigned int hash(int cx, int cy) {
+        return ((unsigned int) cx * 73856093u) ^ ((unsigned int) cy * 19349663u);
+    }
+    public:
+        SpatialHash(float cellSize, int maxCellsPerObject) {
+            this->cellSize = cellSize;
+            this->maxCellsPerObject = maxCellsPerObject;
+        }
+        // Hashes the moving bodies, objectCount being the size of the list their indices point into
+        template <typename T>
+        void build(const std::vector<T*> &bodies, int objectCount) {
+            boxes.resize(objectCount);
+            stamps.assign(objectCount, 0);
+            stamp = 0;
+            oversized.clear();
+            entries.clear();
+            
+            for (auto &obj : bodies) {
+                AABB box = obj->bounds();
+                boxes[obj->index] = box;
+                
+                int x0 = cell(box.minX), y0 = cell(box.minY);
+                int x1 = cell(box.maxX), y1 = cell(box.maxY);
+                long long covered = (long long) (x1 - x0 + 1) * (y1 - y0 + 1);
+                if (covered > maxCellsPerObject) {
+                    oversized.push_back(obj->index);
+                    continue;
+                }
+                for (int y = y0; y <= y1; y++) {
+                    for (int x = x0; x <= x1; x++) {
+                        entries.push_back({ hash(x, y), obj->index });
+                    }
+                }
+            }
+            
+            // Power of two bucket count, roughly twice the entry count
+            unsigned int buckets = 64;
+            while (buckets < entries.size() * 2) buckets <<= 1;
+            bucketMask = buckets - 1;
+            
+            bucketStart.assign(buckets + 1, 0);
+            for (auto &e : entries) {
+                bucketStart[(e.first & bucketMask) + 1]++;
+            }
+            for (unsigned int i = 0; i < buckets; i++) {
+                bucketStart[i + 1] += bucketStart[i];
+            }
+            bucketItems.resize(entries.size());
+            bucketFill.assign(bucketStart.begin(), bucketStart.end() - 1);
+            for (auto &e : entries) {
+                bucketItems[bucketFill[e.first & bucketMask]++] = e.second;
+            }
+        }
+        // Appends the indices of every object whose bounds overlap the box, each at most once
+        void query(AABB box, std::vector<int> &out) {
+            stamp++;
+            int x0 = cell(box.minX), y0 = cell(box.minY);
+            int x1 = cell(box.maxX), y1 = cell(box.maxY);
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    unsigned int b = hash(x, y) & bucketMask;
+                    for (int i = bucketStart[b]; i < bucketStart[b + 1]; i++) {
+                        int index = bucketItems[i];
+                        if (stamps[index] == stamp) continue;
+                        stamps[index] = stamp;
+                        
+                        if (boxes[index].overlaps(box)) out.push_back(index);
+                    }
+                }
+            }
+            for (auto &index : oversized) {
+                if (boxes[index].overlaps(box)) out.push_back(index);
+            }
+        }
+};
+
+// Bounding volume hierarchy over the static shapes, built once after the level is loaded.
+// Leaves keep the shapes themselves, so it survives other objects changing index.
+class StaticTree {
+    struct Node {
+        AABB box;
+        // Inner nodes have two children, leaves a range of items
+        int left = -1, right = -1;
+        int first = 0, count = 0;
+    };
+    struct Item {
+        AABB box;
+        WorldObject *shape;
+    };
+    std::vector<Node> nodes;
+    std::vector<Item> items;
+    // Shapes spanning a large part of the level, like a floor, would widen every node
+    // on their side of the tree, so they are checked directly
+    std::vector<Item> oversized;
+    
+    static const int LEAF_SIZE = 4;
+    // Deeper than any tree built from fewer than 2^32 shapes
+    static const int MAX_DEPTH = 64;
+    
+    int build_node(int first, int count) {
+        Node node;
+        node.box = items[first].box;
+        for (int i = first + 1; i < first + count; i++) {
+            AABB &b = items[i].box;
+            node.box = { std::min(node.box.minX, b.minX), std::min(node.box.minY, b.minY),
+                         std::max(node.box.maxX, b.maxX), std::max(node.box.maxY, b.maxY) };
+        }
+        int index = nodes.size();
+        nodes.push_back(node);
+        if (count <= LEAF_SIZE) {
+            nodes[index].first = first;
+            nodes[index].count = count;
+            return index;
+        }
+        
+        // Split at the median center along the longer side
+        bool alongX = node.box.maxX - node.box.minX >= node.box.maxY - node.box.minY;
+        int half = count / 2;
+        std::nth_element(items.begin() + first, items.begin() + first + half, items.begin() + first + count,
+                         [alongX](const Item &a, const Item &b) {
+                             return alongX ? a.box.minX + a.box.maxX < b.box.minX + b.box.maxX
+                                           : a.box.minY + a.box.maxY < b.box.minY + b.box.maxY;
+                         });
+        int left = build_node(first, half);
+        int right = build_node(first + half, count - half);
+        nodes[index].left = left;
+        nodes[index].right = right;
+        return index;
+    }
+    public:
+        // Static shapes must have been baked before, their bounds are read once here
+        void build(std::vector<WorldObject*> &objects) {
+            nodes.clear();
+            items.clear();
+            oversized.clear();
+            AABB level = { 0, 0, 0, 0 };
+            for (auto &obj : objects) {
+                if (!is_static(obj->type)) continue;
+                AABB box = obj->bounds();
+                level = items.empty() ? box : AABB{ std::min(level.minX, box.minX), std::min(level.minY, box.minY),
+                                                    std::max(level.maxX, box.maxX), std::max(level.maxY, box.maxY) };
+                items.push_back({ box, obj });
+            }
+            
+            float limitX = (level.maxX - level.minX) / 4, limitY = (level.maxY - level.minY) / 4;
+            for (int i = 0; i < (int) items.size(); i++) {
+                AABB &b = items[i].box;
+                if (items.size() > LEAF_SIZE && (b.maxX - b.minX > limitX || b.maxY - b.minY > limitY)) {
+                    oversized.push_back(items[i]);
+                    items[i--] = items.back();
+                    items.pop_back();
+                }
+            }
+            if (!items.empty()) build_node(0, items.size());
+        }
+        // Appends the indices of every static shape whose bounds overlap the box
+        void query(AABB box, std::vector<int> &out) {
+            for (auto &item : oversized) {
+                if (item.box.overlaps(box)) out.push_back(item.shape->index);
+            }
+            if (nodes.empty()) return;
+            
+            if (!nodes[0].box.overlaps(box)) return;
+            
+            // Children are tested before they are pushed, so only overlapping nodes are visited
+            int stack[MAX_DEPTH];
+            int top = 0;
+            stack[top++] = 0;
+            while (top > 0) {
+                const Node &node = nodes[stack[--top]];
+                if (node.count > 0) {
+                    for (int i = node.first; i < node.first + node.count; i++) {
+                        if (items[i].box.overlaps(box)) out.push_back(items[i].shape->index);
+                    }
+                    continue;
+                }
+                if (nodes[node.left].box.overlaps(box)) stack[top++] = node.left;
+                if (nodes[node.right].box.overlaps(box)) stack[top++] = node.right;
+            }
+        }
+        int size() {
+            return items.size() + oversized.size();
+        }
+};
+
+// Fixed set of worker threads that run indexed tasks alongside the calling thread
+class WorkerPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    
+    const std::function<void(int)> *task = nullptr;
+    int taskCount = 0;
+    std::atomic<int> nextTask{ 0 };
+    int busy = 0;
+    unsigned int generation = 0;
+    bool stopping = false;
+    
+    void work() {
+        int i;
+        while ((i = nextTask.fetch_add(1)) < taskCount) {
+            (*task)(i);
+        }
+    }
+    void loop() {
+        PROFILE_THREAD("worker");
+        unsigned int seen = 0;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+            }
+            work();
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (--busy == 0) done.notify_one();
+            }
+        }
+    }
+    public:
+        // Total threads taking part in run(), including the caller
+        WorkerPool(int threadCount) {
+            for (int i = 1; i < threadCount; i++) {
+                threads.emplace_back(&WorkerPool::loop, this);
+            }
+        }
+        ~WorkerPool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto &t : threads) t.join();
+        }
+        int size() {
+            return threads.size() + 1;
+        }
+        // Calls fn(i) for every i in [0, count) and returns once all calls finished
+        void run(int count, const std::function<void(int)> &fn) {
+            if (threads.empty() || count <= 1) {
+                for (int i = 0; i < count; i++) fn(i);
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                task = &fn;
+                taskCount = count;
+                nextTask = 0;
+                busy = threads.size();
+                generation++;
+            }
+            wake.notify_all();
+            work();
+            
+            std::unique_lock<std::mutex> lock(mutex);
+            done.wait(lock, [this] { return busy == 0; });
+        }
+};
+
+struct ContactPair {
+    Ball *a;
+    WorldObject *b;
+    ContactKernel kernel;
+};
+
+// Splits contacts into batches where no two contacts share a dynamic body, by greedy
+// graph coloring in contact order. Every batch can then be solved in parallel, and the
+// outcome doesn't depend on how the batch is divided between threads.
+class ContactBatches {
+    std::vector<unsigned long long> usedColors;
+    std::vector<int> colors, fill;
+    public:
+        // Colors beyond the mask width share one batch that is solved serially
+        static const int MAX_COLORS = 64;
+        
+        std::vector<Manifold> manifolds;
+        std::vector<int> batchStart;
+        
+        void build(const std::vector<Manifold> &contacts, int bodyCount) {
+            usedColors.assign(bodyCount, 0);
+            colors.resize(contacts.size());
+            batchStart.assign(MAX_COLORS + 2, 0);
+            
+            for (size_t i = 0; i < contacts.size(); i++) {
+                const Manifold &c = contacts[i];
+                bool dynamicB = is_dynamic(c.b->type);
+                unsigned long long used = usedColors[c.a->index] | (dynamicB ? usedColors[c.b->index] : 0);
+                
+                int color = MAX_COLORS;
+                if (~used != 0) {
+                    color = __builtin_ctzll(~used);
+                    usedColors[c.a->index] |= 1ull << color;
+                    if (dynamicB) usedColors[c.b->index] |= 1ull << color;
+                }
+                colors[i] = color;
+                batchStart[color + 1]++;
+            }
+            for (int i = 0; i <= MAX_COLORS; i++) {
+                batchStart[i + 1] += batchStart[i];
+            }
+            manifolds.resize(contacts.size());
+            fill.assign(batchStart.begin(), batchStart.end() - 1);
+            for (size_t i = 0; i < contacts.size(); i++) {
+                manifolds[fill[colors[i]]++] = contacts[i];
+            }
+        }
+        int batch_count() {
+            return MAX_COLORS + 1;
+        }
+};
+
+// Normal impulses of the previous step's contacts, looked up by body pair to warm start
+// the solver. Sorted by pair, so lookups are binary searches and nothing is allocated per step.
+class ContactCache {
+    struct Entry {
+        WorldObject *a, *b;
+        float impulse;
+    };
+    std::vector<Entry> entries;
+    static bool before(const Entry &x, const Entry &y) {
+        std::less<WorldObject*> less;
+        return x.a != y.a ? less(x.a, y.a) : less(x.b, y.b);
+    }
+    public:
+        int size() {
+            return entries.size();
+        }
+        const Entry &at(int i) {
+            return entries[i];
+        }
+        float find(WorldObject *a, WorldObject *b) {
+            Entry key = { a, b, 0 };
+            auto found = std::lower_bound(entries.begin(), entries.end(), key, before);
+            return found != entries.end() && found->a == a && found->b == b ? found->impulse : 0;
+        }
+        // Replaces the entries with the contacts that pushed this step
+        void store(const std::vector<Manifold> &manifolds) {
+            entries.clear();
+            for (auto &m : manifolds) {
+                if (m.impulse > 0) entries.push_back({ m.a, m.b, m.impulse });
+            }
+            std::sort(entries.begin(), entries.end(), before);
+        }
+        // For restoring snapshots, call sort() once everything is in
+        void add(WorldObject *a, WorldObject *b, float impulse) {
+            entries.push_back({ a, b, impulse });
+        }
+        void sort() {
+            std::sort(entries.begin(), entries.end(), before);
+        }
+        void clear() {
+            entries.clear();
+        }
+        // An object despawned, a new one may get its address
+        void forget(WorldObject *obj) {
+            entries.erase(std::remove_if(entries.begin(), entries.end(), [obj](const Entry &e) {
+                              return e.a == obj || e.b == obj;
+                          }), entries.end());
+        }
+};
+
+// Union-find over object indices, grouping bodies connected by contacts into islands
+class Islands {
+    std::vector<int> parent;
+    public:
+        void reset(int count) {
+            parent.resize(count);
+            for (int i = 0; i < count; i++) parent[i] = i;
+        }
+        int find(int i) {
+            while (parent[i] != i) {
+                parent[i] = parent[parent[i]];
+                i = parent[i];
+            }
+            return i;
+        }
+        void unite(int a, int b) {
+            a = find(a);
+            b = find(b);
+            if (a != b) parent[std::max(a, b)] = std::min(a, b);
+        }
+};
+
+enum ConstraintType {
+    CONSTRAINT_DISTANCE,
+    CONSTRAINT_PIN,
+    CONSTRAINT_HINGE,
+    CONSTRAINT_COUNT
+};
+
+// Distances keep a and b rest apart, pins keep a rest away from a fixed anchor and
+// hinges keep the angle from a around b to c at rest radians. Unused bodies are nullptr.
+struct Constraint {
+    ConstraintType type;
+    Ball *a, *b, *c;
+    Vec2f anchor;
+    float rest;
+    // Inverse stiffness, 0 is rigid
+    float compliance;
+};
+
+// Position based (XPBD) solver for constraints between balls. The constrained balls are packed
+// into arrays and stepped again in substeps, each integrating them, projecting every constraint
+// once and taking the velocity from how far they moved. Small substeps keep long chains from
+// stretching far better than more projections per step. Constraints are colored like contacts
+// so each batch can be projected in parallel with the same outcome on any thread count.
+class ConstraintSolver {
+    struct Packed {
+        ConstraintType type;
+        // Slots into the packed bodies, -1 when unused
+        int a, b, c;
+        Vec2f anchor;
+        float rest, compliance;
+    };
+    std::vector<Constraint> constraints;
+    // Packed in batch order, rebuilt whenever a constraint is added or removed. Each batch
+    // is sorted by type so projecting it doesn't jump between the cases.
+    std::vector<Packed> packed;
+    std::vector<float> lambda;
+    // Start of every (color, type) run, batch b spans runs b * CONSTRAINT_COUNT onwards
+    std::vector<int> runStart;
+    bool stale = false;
+    int substeps = SUBSTEPS;
+    
+    std::vector<Ball*> bodies;
+    std::vector<float> x, y, vx, vy, startX, startY, resistance, inverseMass;
+    // Bodies hanging together through constraints share an island and sleep and wake together
+    std::vector<int> island;
+    std::vector<char> islandAwake;
+    std::unordered_map<Ball*, int> slots;
+    std::vector<unsigned long long> usedColors;
+    std::vector<int> colors, fill;
+    Islands islands;
+    
+    int slot_of(Ball *ball) {
+        if (ball == nullptr) return -1;
+        auto found = slots.emplace(ball, bodies.size());
+        if (found.second) bodies.push_back(ball);
+        return found.first->second;
+    }
+    void rebuild() {
+        bodies.clear();
+        slots.clear();
+        std::vector<Packed> unordered(constraints.size());
+        for (size_t i = 0; i < constraints.size(); i++) {
+            const Constraint &c = constraints[i];
+            unordered[i] = { c.type, slot_of(c.a), slot_of(c.b), slot_of(c.c), c.anchor, c.rest, c.compliance };
+        }
+        int count = bodies.size();
+        for (auto *v : { &x, &y, &vx, &vy, &startX, &startY, &resistance, &inverseMass }) {
+            v->resize(count);
+        }
+        
+        islands.reset(count);
+        usedColors.assign(count, 0);
+        colors.resize(unordered.size());
+        int runs = (MAX_COLORS + 1) * CONSTRAINT_COUNT;
+        runStart.assign(runs + 1, 0);
+        for (size_t i = 0; i < unordered.size(); i++) {
+            const Packed &p = unordered[i];
+            unsigned long long used = 0;
+            for (int s : { p.a, p.b, p.c }) {
+                if (s >= 0) used |= usedColors[s];
+            }
+            for (int s : { p.b, p.c }) {
+                if (s >= 0) islands.unite(p.a, s);
+            }
+            
+            int color = MAX_COLORS;
+            if (~used != 0) {
+                color = __builtin_ctzll(~used);
+                for (int s : { p.a, p.b, p.c }) {
+                    if (s >= 0) usedColors[s] |= 1ull << color;
+                }
+            }
+            colors[i] = color * CONSTRAINT_COUNT + p.type;
+            runStart[colors[i] + 1]++;
+        }
+        for (int i = 0; i < runs; i++) {
+            runStart[i + 1] += runStart[i];
+        }
+        packed.resize(unordered.size());
+        fill.assign(runStart.begin(), runStart.end() - 1);
+        for (size_t i = 0; i < unordered.size(); i++) {
+            packed[fill[colors[i]]++] = unordered[i];
+        }
+        island.resize(count);
+        for (int i = 0; i < count; i++) island[i] = islands.find(i);
+        stale = false;
+    }
+    // Moves the bodies of one constraint towards satisfying it
+    void project(int i, float timeTook) {
+        const Packed &p = packed[i];
+        float alpha = p.compliance / (timeTook * timeTook);
+        switch (p.type) {
+            case CONSTRAINT_DISTANCE:
+            case CONSTRAINT_PIN: {
+                bool pinned = p.type == CONSTRAINT_PIN;
+                float wa = inverseMass[p.a], wb = pinned ? 0 : inverseMass[p.b];
+                float dx = x[p.a] - (pinned ? p.anchor.x : x[p.b]);
+                float dy = y[p.a] - (pinned ? p.anchor.y : y[p.b]);
+                float length = sqrt(dx * dx + dy * dy);
+                if (length == 0 || wa + wb + alpha == 0) return;
+                
+                float change = (p.rest - length - alpha * lambda[i]) / (wa + wb + alpha);
+                lambda[i] += change;
+                float nx = dx / length * change, ny = dy / length * change;
+                x[p.a] += wa * nx; y[p.a] += wa * ny;
+                if (!pinned) {
+                    x[p.b] -= wb * nx; y[p.b] -= wb * ny;
+                }
+                break;
+            }
+            case CONSTRAINT_HINGE: {
+                float ux = x[p.a] - x[p.b], uy = y[p.a] - y[p.b];
+                float vx = x[p.c] - x[p.b], vy = y[p.c] - y[p.b];
+                float lu = ux * ux + uy * uy, lv = vx * vx + vy * vy;
+                if (lu == 0 || lv == 0) return;
+                
+                // Angle from u to v, wrapped so the error takes the short way round
+                float error = Trig::atan2(ux * vy - uy * vx, ux * vx + uy * vy) - p.rest;
+                error -= 2 * M_PI * floor(error / (2 * M_PI) + 0.5f);
+                
+                // Gradients of the angle with respect to each body
+                float gax = uy / lu, gay = -ux / lu;
+                float gcx = -vy / lv, gcy = vx / lv;
+                float gbx = -gax - gcx, gby = -gay - gcy;
+                float wa = inverseMass[p.a], wb = inverseMass[p.b], wc = inverseMass[p.c];
+                float denominator = wa * (gax * gax + gay * gay) + wb * (gbx * gbx + gby * gby) +
+                                    wc * (gcx * gcx + gcy * gcy) + alpha;
+                if (denominator == 0) return;
+                
+                float change = (-error - alpha * lambda[i]) / denominator;
+                lambda[i] += change;
+                x[p.a] += wa * gax * change; y[p.a] += wa * gay * change;
+                x[p.b] += wb * gbx * change; y[p.b] += wb * gby * change;
+                x[p.c] += wc * gcx * change; y[p.c] += wc * gcy * change;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    public:
+        // Colors beyond the mask width share one batch that is projected serially
+        static const int MAX_COLORS = 64;
+        static const int SUBSTEPS = 8;
+        // Constraints projected per parallel task
+        static const int CHUNK = 256;
+        
+        // Fewer substeps let long ropes stretch more
+        void set_substeps(int count) {
+            substeps = std::max(1, count);
+        }
+        
+        int size() {
+            return constraints.size();
+        }
+        const Constraint &at(int i) {
+            return constraints[i];
+        }
+        void add(const Constraint &constraint) {
+            constraints.push_back(constraint);
+            for (Ball *b : { constraint.a, constraint.b, constraint.c }) {
+                if (b != nullptr) b->joints++;
+            }
+            stale = true;
+        }
+        void clear() {
+            for (auto &c : constraints) {
+                for (Ball *b : { c.a, c.b, c.c }) {
+                    if (b != nullptr) b->joints = 0;
+                }
+            }
+            constraints.clear();
+            stale = true;
+        }
+        // Drops every constraint the ball takes part in
+        void remove_body(Ball *ball) {
+            if (ball->joints == 0) return;
+            size_t kept = 0;
+            for (size_t i = 0; i < constraints.size(); i++) {
+                const Constraint &c = constraints[i];
+                if (c.a != ball && c.b != ball && c.c != ball) {
+                    constraints[kept++] = c;
+                    continue;
+                }
+                for (Ball *b : { c.a, c.b, c.c }) {
+                    if (b != nullptr) b->joints--;
+                }
+            }
+            constraints.resize(kept);
+            stale = true;
+        }
+        // Wakes sleeping balls hanging together with an awake one. Runs before integration,
+        // so woken balls take part in the whole step.
+        void wake_connected(BallStore &store) {
+            if (constraints.empty()) return;
+            if (stale) rebuild();
+            islandAwake.assign(bodies.size(), 0);
+            for (size_t i = 0; i < bodies.size(); i++) {
+                if (!bodies[i]->sleeping) islandAwake[island[i]] = 1;
+            }
+            for (size_t i = 0; i < bodies.size(); i++) {
+                if (bodies[i]->sleeping && islandAwake[island[i]]) store.wake(bodies[i]);
+            }
+        }
+        // Joins the bodies of every constraint into the same island
+        void unite(Islands &objectIslands) {
+            for (auto &c : constraints) {
+                if (c.b != nullptr) objectIslands.unite(c.a->index, c.b->index);
+                if (c.c != nullptr) objectIslands.unite(c.a->index, c.c->index);
+            }
+        }
+        // Runs after BallStore integrated the step, with the same gravity
+        void solve(float timeTook, Vec2f gravity, WorkerPool &workers) {
+            if (constraints.empty()) return;
+            if (stale) rebuild();
+            
+            // Undo the bulk integration, the substeps below redo it
+            bool awake = false;
+            for (size_t i = 0; i < bodies.size(); i++) {
+                Ball *b = bodies[i];
+                x[i] = b->previousPosition.x;
+                y[i] = b->previousPosition.y;
+                vx[i] = b->vel.x - b->acceleration.x * timeTook;
+                vy[i] = b->vel.y - b->acceleration.y * timeTook;
+                resistance[i] = b->resistance;
+                // Sleeping balls hold still like anchors
+                inverseMass[i] = b->sleeping || b->mass <= 0 ? 0 : 1 / b->mass;
+                awake = awake || !b->sleeping;
+            }
+            if (!awake) return;
+            
+            float h = timeTook / substeps;
+            int count = bodies.size();
+            for (int substep = 0; substep < substeps; substep++) {
+                for (int i = 0; i < count; i++) {
+                    startX[i] = x[i];
+                    startY[i] = y[i];
+                    if (inverseMass[i] == 0) continue;
+                    vx[i] += (gravity.x - vx[i] * resistance[i]) * h;
+                    vy[i] += (gravity.y - vy[i] * resistance[i]) * h;
+                    x[i] += vx[i] * h;
+                    y[i] += vy[i] * h;
+                }
+                lambda.assign(packed.size(), 0);
+                for (int batch = 0; batch <= MAX_COLORS; batch++) {
+                    int start = runStart[batch * CONSTRAINT_COUNT], end = runStart[(batch + 1) * CONSTRAINT_COUNT];
+                    if (start == end) continue;
+                    bool serial = batch == MAX_COLORS;
+                    int chunks = serial ? 1 : (end - start + CHUNK - 1) / CHUNK;
+                    workers.run(chunks, [&](int chunk) {
+                        int first = serial ? start : start + chunk * CHUNK;
+                        int last = serial ? end : std::min(end, first + CHUNK);
+                        for (int i = first; i < last; i++) project(i, h);
+                    });
+                }
+                for (int i = 0; i < count; i++) {
+                    if (inverseMass[i] == 0) continue;
+                    vx[i] = (x[i] - startX[i]) / h;
+                    vy[i] = (y[i] - startY[i]) / h;
+                }
+            }
+            
+            for (int i = 0; i < count; i++) {
+                Ball *b = bodies[i];
+                if (inverseMass[i] == 0) continue;
+                b->position = { x[i], y[i] };
+                b->vel = { vx[i], vy[i] };
+                // Same fall out of the world as in BallStore::scatter
+                b->respawn_if_fallen();
+            }
+        }
+        // Ropes and pendulum rods as lines, for the ones reaching into the view
+        void draw(AABB view, std::vector<DrawItem> &out) {
+            for (auto &c : constraints) {
+                if (c.type == CONSTRAINT_HINGE || (c.type == CONSTRAINT_PIN && c.rest == 0)) continue;
+                bool pinned = c.type == CONSTRAINT_PIN;
+                Vec2f from = pinned ? c.anchor : c.b->drawn_from(), to = pinned ? c.anchor : c.b->position;
+                Vec2f end = c.a->position;
+                AABB box = { std::min(to.x, end.x), std::min(to.y, end.y), std::max(to.x, end.x), std::max(to.y, end.y) };
+                if (!box.overlaps(view)) continue;
+                
+                out.push_back({ DRAW_LINE, -1, from, to, c.a->drawn_from(), c.a->position, 0, 0, 0 });
+            }
+        }
+};
+
+// State of one object inside a WorldSnapshot. Plain data only: references to other
+// objects are stored as their index in the object list, -1 for none. Enums and flags
+// are kept as plain integers, files are read into them and checked afterwards.
+struct BodyState {
+    // A ShapeType
+    int type;
+    // Kinematics, only kept for balls
+    int colliding;
+    int levelShape;
+    float mass, resistance;
+    Vec2f position, previousPosition, vel, acceleration;
+    union {
+        struct {
+            TextureHandle sprite;
+            float radius, restTime;
+            Vec2f restAnchor;
+            // 0 or 1
+            uint8_t sleeping, canSleep;
+            int group;
+        } ball;
+        struct {
+            Vec2f endPosition;
+            int side;
+        } line;
+        struct {
+            TextureHandle sprite;
+            float width, height, angle;
+        } rectangle;
+        struct {
+            int knob;
+            float length;
+        } pendulum;
+    };
+};
+
+// A cached contact impulse inside a WorldSnapshot
+struct ContactState {
+    int a, b;
+    float impulse;
+};
+
+// A Constraint inside a WorldSnapshot, bodies stored as object indices, -1 for none
+struct ConstraintState {
+    // A ConstraintType
+    int type;
+    int a, b, c;
+    Vec2f anchor;
+    float rest, compliance;
+};
+
+// Everything Aluminium::restore needs to put a world back the way it was.
+// Keep one around and capture into it repeatedly, its storage is reused.
+struct WorldSnapshot {
+    std::vector<BodyState> bodies;
+    std::vector<ConstraintState> constraints;
+    std::vector<ContactState> contacts;
+    int player = -1;
+    Vec2f camera, gravity, lastGravity;
+
+    // File layout: this header followed by bodyCount BodyState records,
+    // constraintCount ConstraintState records and contactCount ContactState records
+    struct Header {
+        char magic[4];
+        int version;
+        int bodyCount, constraintCount, contactCount;
+        int player;
+        Vec2f camera, gravity, lastGravity;
+    };
+    static const int VERSION = 5;
+    
+    // Empty vectors may have no storage, which fread and fwrite must not be given
+    template <typename T>
+    static bool write_array(const std::vector<T> &v, FILE *file) {
+        return v.empty() || fwrite(v.data(), sizeof(T), v.size(), file) == v.size();
+    }
+    template <typename T>
+    static bool read_array(std::vector<T> &v, FILE *file) {
+        return v.empty() || fread(v.data(), sizeof(T), v.size(), file) == v.size();
+    }
+
+    // Texture handles are stored as they are, so a file only loads back into a
+    // process that interned the same texture names in the same order
+    bool save(const char *path) {
+        FILE *file = fopen(path, "wb");
+        if (file == NULL) {
+            fprintf(stderr, "Snapshot Error: cannot open %s for writing\n", path);
+            return false;
+        }
+        Header header = { { 'A', 'L', 'S', 'N' }, VERSION, (int) bodies.size(), (int) constraints.size(),
+                          (int) contacts.size(), player, camera, gravity, lastGravity };
+        bool written = fwrite(&header, sizeof(Header), 1, file) == 1 &&
+                       write_array(bodies, file) && write_array(constraints, file) && write_array(contacts, file);
+        fclose(file);
+        if (!written) fprintf(stderr, "Snapshot Error: cannot write %s\n", path);
+        return written;
+    }
+    bool load(const char *path) {
+        FILE *file = fopen(path, "rb");
+        if (file == NULL) {
+            fprintf(stderr, "Snapshot Error: cannot open %s\n", path);
+            return false;
+        }
+        Header header;
+        bool valid = fread(&header, sizeof(Header), 1, file) == 1 && !memcmp(header.magic, "ALSN", 4) &&
+                     header.version == VERSION && header.bodyCount >= 0 && header.constraintCount >= 0 && header.contactCount >= 0;
+        // The records have to fit in the rest of the file before anything is allocated for them
+        if (valid) {
+            long start = ftell(file);
+            valid = start >= 0 && fseek(file, 0, SEEK_END) == 0;
+            long end = valid ? ftell(file) : -1;
+            unsigned long long needed = (unsigned long long) header.bodyCount * sizeof(BodyState) +
+                                        (unsigned long long) header.constraintCount * sizeof(ConstraintState) +
+                                        (unsigned long long) header.contactCount * sizeof(ContactState);
+            valid = end >= start && needed <= (unsigned long long) (end - start) && fseek(file, start, SEEK_SET) == 0;
+        }
+        // Read aside, so a file that turns out to be invalid leaves this snapshot as it was
+        std::vector<BodyState> readBodies(valid ? header.bodyCount : 0);
+        std::vector<ConstraintState> readConstraints(valid ? header.constraintCount : 0);
+        std::vector<ContactState> readContacts(valid ? header.contactCount : 0);
+        valid = valid && read_array(readBodies, file) && read_array(readConstraints, file) && read_array(readContacts, file);
+        fclose(file);
+        // Types are in range, flags 0 or 1, references land inside the file, sprites among
+        // the interned textures, and every knob belongs to one pendulum
+        int count = valid ? readBodies.size() : 0;
+        int sprites = Assets::get().handle_count();
+        auto sprite = [&](TextureHandle handle) {
+            return handle >= 0 && handle < sprites;
+        };
+        std::vector<char> knobs(count, 0);
+        for (int i = 0; valid && i < count; i++) {
+            BodyState &b = readBodies[i];
+            valid = b.type > SHAPE_NONE && b.type < SHAPE_COUNT && b.colliding >= -1 && b.colliding < count;
+            if (valid && b.type == SHAPE_BALL) valid = sprite(b.ball.sprite) && b.ball.sleeping <= 1 && b.ball.canSleep <= 1;
+            if (valid && b.type == SHAPE_RECTANGLE) valid = sprite(b.rectangle.sprite);
+            if (valid && b.type == SHAPE_PENDULUM) {
+                int knob = b.pendulum.knob;
+                valid = knob >= 0 && knob < count && readBodies[knob].type == SHAPE_BALL && !knobs[knob];
+                if (valid) knobs[knob] = 1;
+            }
+        }
+        // Constraints only hold balls, and exactly the ones their type uses
+        auto ball = [&](int index) {
+            return index >= 0 && index < count && readBodies[index].type == SHAPE_BALL;
+        };
+        for (size_t i = 0; valid && i < readConstraints.size(); i++) {
+            ConstraintState &c = readConstraints[i];
+            valid = c.type >= CONSTRAINT_DISTANCE && c.type < CONSTRAINT_COUNT && ball(c.a) &&
+                    (c.type == CONSTRAINT_PIN ? c.b == -1 : ball(c.b)) &&
+                    (c.type == CONSTRAINT_HINGE ? ball(c.c) : c.c == -1);
+        }
+        for (size_t i = 0; valid && i < readContacts.size(); i++) {
+            ContactState &c = readContacts[i];
+            valid = ball(c.a) && c.b >= 0 && c.b < count && c.a != c.b;
+        }
+        valid = valid && header.player >= -1 && header.player < count &&
+                (header.player < 0 || readBodies[header.player].type == SHAPE_BALL);
+        if (!valid) {
+            fprintf(stderr, "Snapshot Error: %s is not a valid snapshot\n", path);
+            return false;
+        }
+        bodies.swap(readBodies);
+        constraints.swap(readConstraints);
+        contacts.swap(readContacts);
+        player = header.player;
+        camera = header.camera;
+        gravity = header.gravity;
+        lastGravity = header.lastGravity;
+        return true;
+    }
+};
+
+// Binary level file. It is memory mapped, so only the parts describing chunks
+// near the camera are ever read. Layout, every section 4-byte aligned:
+//   LevelHeader
+//   textureCount texture names, LEVEL_NAME_LENGTH bytes each, zero terminated
+//   shapeCount LevelShape records
+//   chunkCount LevelChunk entries sorted by y, then x
+//   referenceCount shape indices, each chunk owning a contiguous run
+const int LEVEL_NAME_LENGTH = 32;
+// Side of a chunk in world units for levels written by export_level
+const float LEVEL_CHUNK_SIZE = 1024.0f;
+
+struct LevelHeader {
+    char magic[4];
+    int version;
+    float chunkSize;
+    int textureCount, shapeCount, chunkCount, referenceCount;
+    // Shape the player is spawned from, -1 for none
+    int player;
+};
+
+// One object of the level. Static shapes are listed by every chunk their bounds touch,
+// dynamic ones only by the chunk holding their position.
+struct LevelShape {
+    ShapeType type;
+    // Index into the texture names, -1 for none
+    int texture;
+    // Ball center, line start, rectangle corner or pendulum pivot
+    Vec2f position;
+    Vec2f endPosition;
+    // Rectangles, the angle in degrees
+    float width, height, angle;
+    // Balls and pendulum knobs
+    float radius, mass;
+    float length;
+    int side;
+};
+
+struct LevelChunk {
+    int x, y;
+    unsigned int firstReference, referenceCount;
+};
+
+class LevelFile {
+    const unsigned char *data = nullptr;
+    size_t size = 0;
+    
+    const LevelHeader *header = nullptr;
+    const char *names = nullptr;
+    const LevelShape *shapes = nullptr;
+    const LevelChunk *chunks = nullptr;
+    const unsigned int *references = nullptr;
+    public:
+        static const int VERSION = 1;
+        
+        ~LevelFile() {
+            close();
+        }
+        // Maps the file and checks the header and chunk table; shapes are only read when their chunk loads
+        bool open(const char *path) {
+            close();
+#if defined(_WIN32)
+            // No mmap here, read the file instead
+            FILE *file = fopen(path, "rb");
+            if (file == NULL) {
+                fprintf(stderr, "Level Error: cannot open %s\n", path);
+                return false;
+            }
+            fseek(file, 0, SEEK_END);
+            size = ftell(file);
+            fseek(file, 0, SEEK_SET);
+            unsigned char *buffer = (unsigned char*) malloc(size);
+            if (buffer == NULL || fread(buffer, 1, size, file) != size) {
+                fprintf(stderr, "Level Error: cannot read %s\n", path);
+                free(buffer);
+                fclose(file);
+                size = 0;
+                return false;
+            }
+            fclose(file);
+            data = buffer;
+#else
+            int fd = ::open(path, O_RDONLY);
+            if (fd < 0) {
+                fprintf(stderr, "Level Error: cannot open %s\n", path);
+                return false;
+            }
+            struct stat info;
+            if (fstat(fd, &info) != 0 || info.st_size == 0) {
+                fprintf(stderr, "Level Error: cannot read %s\n", path);
+                ::close(fd);
+                return false;
+            }
+            size = info.st_size;
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            // The mapping stays valid after the descriptor is closed
+            ::close(fd);
+            if (mapped == MAP_FAILED) {
+                fprintf(stderr, "Level Error: cannot map %s\n", path);
+                size = 0;
+                return false;
+            }
+            data = (const unsigned char*) mapped;
+#endif
+            if (!validate()) {
+                fprintf(stderr, "Level Error: %s is not a valid level\n", path);
+                close();
+                return false;
+            }
+            return true;
+        }
+        void close() {
+            if (data != nullptr) {
+#if defined(_WIN32)
+                free((void*) data);
+#else
+                munmap((void*) data, size);
+#endif
+            }
+            data = nullptr;
+            size = 0;
+            header = nullptr;
+        }
+        bool is_open() {
+            return header != nullptr;
+        }
+        float chunk_size() {
+            return header->chunkSize;
+        }
+        int player() {
+            return header->player;
+        }
+        int shape_count() {
+            return header->shapeCount;
+        }
+        // Binary search of the chunk table, nullptr when the chunk is empty
+        const LevelChunk *find(int x, int y) {
+            const LevelChunk *end = chunks + header->chunkCount;
+            const LevelChunk *found = std::lower_bound(chunks, end, std::make_pair(y, x),
+                [](const LevelChunk &c, std::pair<int, int> key) {
+                    return std::make_pair(c.y, c.x) < key;
+                });
+            return found != end && found->x == x && found->y == y ? found : nullptr;
+        }
+        const unsigned int *references_of(const LevelChunk *chunk) {
+            return references + chunk->firstReference;
+        }
+        // nullptr when the index or the record itself is out of range
+        const LevelShape *shape(unsigned int index) {
+            if (index >= (unsigned int) header->shapeCount) return nullptr;
+            const LevelShape *s = &shapes[index];
+            if (s->type <= SHAPE_NONE || s->type >= SHAPE_COUNT) return nullptr;
+            if ((s->type == SHAPE_BALL || s->type == SHAPE_PENDULUM) && !(s->radius > 0)) return nullptr;
+            if (s->texture < -1 || s->texture >= header->textureCount) return nullptr;
+            return s;
+        }
+        const char *texture_name(int index) {
+            return names + (size_t) index * LEVEL_NAME_LENGTH;
+        }
+    private:
+        bool validate() {
+            if (size < sizeof(LevelHeader)) return false;
+            const LevelHeader *h = (const LevelHeader*) data;
+            if (memcmp(h->magic, "ALLV", 4) || h->version != VERSION || !(h->chunkSize > 0)) return false;
+            if (h->textureCount < 0 || h->shapeCount < 0 || h->chunkCount < 0 || h->referenceCount < 0) return false;
+            if (h->player < -1 || h->player >= h->shapeCount) return false;
+            
+            size_t offset = sizeof(LevelHeader);
+            size_t sections[4] = { (size_t) h->textureCount * LEVEL_NAME_LENGTH, (size_t) h->shapeCount * sizeof(LevelShape),
+                                   (size_t) h->chunkCount * sizeof(LevelChunk), (size_t) h->referenceCount * sizeof(unsigned int) };
+            size_t starts[4];
+            for (int i = 0; i < 4; i++) {
+                starts[i] = offset;
+                offset += sections[i];
+            }
+            if (offset > size) return false;
+            
+            names = (const char*) (data + starts[0]);
+            shapes = (const LevelShape*) (data + starts[1]);
+            chunks = (const LevelChunk*) (data + starts[2]);
+            references = (const unsigned int*) (data + starts[3]);
+            for (int i = 0; i < h->textureCount; i++) {
+                if (texture_name(i)[LEVEL_NAME_LENGTH - 1] != 0) return false;
+            }
+            for (int i = 0; i < h->chunkCount; i++) {
+                const LevelChunk &c = chunks[i];
+                if (c.firstReference > (unsigned int) h->referenceCount ||
+                    c.referenceCount > (unsigned int) h->referenceCount - c.firstReference) return false;
+                if (i > 0 && std::make_pair(chunks[i - 1].y, chunks[i - 1].x) >= std::make_pair(c.y, c.x)) return false;
+            }
+            header = h;
+            return true;
+        }
+};
+
+class Game
+{
+   public:
+      const char *displayName = "";
+      virtual ~Game() {};
+      virtual void init() {};
+      virtual void load() {};
+    
+      // Takes an event and where the mouse was when it was polled
+      virtual void handle_event(SDL_Event, SDL_Point) {};
+
+      // Advances the simulation by one fixed step of this many seconds
+      virtual void update(float) {};
+      // Fills the frame with what to draw after the latest step, which another thread may then draw
+      virtual void prepare_frame(RenderFrame &) {};
+      // Draws the world at the given progress between the previous and current step
+      virtual void render(float) {};
+};
+
+struct MemoryStats {
+    PoolStats balls, lines, rectangles, pendulums;
+};
+
+class Aluminium : public Game {
+    Ball *player = nullptr;
+    std::vector<WorldObject*> objects;
+    
+    ObjectPool<Ball> balls;
+    Archetype<Line> lines;
+    Archetype<Rectangle> rectangles;
+    Archetype<Pendulum> pendulums;
+    // Dense list of the balls in the world, knobs included
+    BallStore ballStore;
+    // Pendulums, ropes and anything else joined by constraints
+    ConstraintSolver constraints;
+    
+    SpatialHash broadPhase{ 64, 64 };
+    // Set when objects were added or removed since the last broad phase build
+    bool broadPhaseStale = true;
+    // Lines and rectangles, rebuilt by bake() when one is added or removed
+    StaticTree staticTree;
+    bool staticsStale = true;
+    // Streamed level, see load_level()
+    LevelFile level;
+    // Loaded static shapes of the level and how many active chunks list each
+    struct StreamedShape {
+        WorldObject *object;
+        int chunks;
+    };
+    std::unordered_map<unsigned int, StreamedShape> streamedShapes;
+    // Dynamic shapes currently in the world. They spawn when their chunk loads and
+    // are dropped with whatever chunk they are in when it unloads.
+    std::unordered_set<unsigned int> spawnedShapes;
+    std::unordered_map<long long, const LevelChunk*> activeChunks;
+    std::unordered_set<long long> prefetchedChunks;
+    std::vector<const LevelChunk*> leaving;
+    std::vector<WorldObject*> leavingShapes;
+    // Set after a rebuild, when streamed shapes may no longer be listed by any active chunk
+    bool streamOrphans = false;
+    StreamStats streamStats;
+    // Seconds of player movement the streamed area reaches ahead
+    static constexpr float STREAM_LOOKAHEAD = 1.0f;
+    
+    // Bumped whenever cached static lists may be wrong: a new tree or shifted object indices
+    int staticsVersion = 0;
+    // How far past its bounds a ball's cached static list reaches
+    static constexpr float STATIC_MARGIN = 16.0f;
+    std::vector<int> candidates, visible;
+    // Where the simulation looks from. The renderer keeps its own in Projection.
+    Vec2f camera = { 0, 0 };
+    // Used by render() when drawing on the simulation's thread
+    RenderFrame frame;
+    // Drawn behind everything else, rebuilt by prepare_frame() after bake()
+    std::shared_ptr<const StaticLayer> staticLayer;
+    bool staticLayerStale = true;
+    // Texture uploads need the renderer's thread, which may not be the one stepping
+    bool uploadsTextures = true;
+    std::vector<ContactPair> contacts;
+    // Narrow phase result of every candidate pair, and whether the pair collided
+    std::vector<Manifold> pairManifolds;
+    std::vector<char> contactCollided;
+    std::vector<Manifold> manifolds;
+    ContactBatches contactBatches;
+    ContactCache contactCache;
+    std::unique_ptr<WorkerPool> workers{ new WorkerPool(std::max(1u, std::thread::hardware_concurrency())) };
+    std::vector<ContactTimes> chunkTimes;
+    ContactTimes contactTimes;
+    // Largest impulse each object took this step, picks what it counts as colliding with
+    std::vector<float> strongest;
+    
+    Islands islands;
+    std::vector<char> islandReady, islandWoken;
+    // Last collision group handed to a rope
+    int ropeGroups = 0;
+    Vec2f lastGravity = Vars::gravity;
+    CollisionStats stats;
+    PhaseTimings timings;
+    Quality quality = FrameBudget::level_quality(0);
+    
+    // Pairs or contacts handled per parallel task
+    static const int CONTACT_CHUNK = 128;
+    // Passes over all contacts are set by the quality. Impulses carry over from the previous
+    // step, so piles start close to their answer and a few passes are enough.
+    // Fraction of the overlap removed per position pass, and the overlap left alone so
+    // resting contacts stay touching
+    static constexpr float POSITION_FRACTION = 0.8f;
+    static constexpr float CONTACT_SLOP = 0.01f;
+    // Static shapes bounce balls like a body this heavy would
+    static constexpr float STATIC_MASS = 4.0f;
+    // Contacts closing slower than this don't bounce, which lets stacks come to rest
+    static constexpr float RESTITUTION_SPEED = 60.0f;
+    // Balls count as resting while they stay this close to where they started resting.
+    // Settled piles jitter by fractions of a unit every step, so instant speed is no use.
+    static constexpr float SLEEP_DISTANCE = 2.0f;
+    // Seconds a whole island has to rest before it goes to sleep, or balls far from the
+    // camera when the quality allows it
+    static constexpr float SLEEP_DELAY = 0.5f;
+    static constexpr float FAR_SLEEP_DELAY = 0.1f;
+    // A ball moving less than this fraction of its radius per step can't cross anything unseen
+    static constexpr float SWEEP_FRACTION = 0.5f;
+    // Swept balls stop this far past the time of impact so the contact kernels see the overlap
+    static constexpr float SWEEP_SKIN = 0.05f;
+    
+    // Ball stopped at its time of impact and the step time it has left to travel
+    struct SweptBall {
+        Ball *ball;
+        float remaining;
+    };
+    std::vector<SweptBall> swept;
+    
+    // Earliest impact of a ball moving from one point to another against the current candidates,
+    // as a fraction of the motion. 1 when nothing is hit.
+    float earliest_impact(Ball *ball, Vec2f from, Vec2f to, bool othersMoving) {
+        float best = 1, t = 1;
+        for (auto &candidate : candidates) {
+            WorldObject *other = objects[candidate];
+            if (other == ball || contactTable[SHAPE_BALL][other->type] == nullptr) continue;
+            
+            bool hit = false;
+            switch (other->type) {
+                case SHAPE_LINE: {
+                    Line *line = (Line*) other;
+                    hit = Sweep::circle_segment(from, to, ball->radius, line->position, line->endPosition, t);
+                    break;
+                }
+                case SHAPE_RECTANGLE: {
+                    hit = Sweep::circle_rectangle(from, to, ball->radius, (Rectangle*) other, t);
+                    break;
+                }
+                case SHAPE_BALL: {
+                    Ball *b = (Ball*) other;
+                    Vec2f start = othersMoving ? b->previousPosition : b->position;
+                    hit = Sweep::circle_circle(from, to, ball->radius, start, b->position, b->radius, t);
+                    break;
+                }
+                default:
+                    break;
+            }
+            if (hit && t < best) best = t;
+        }
+        return best;
+    }
+    // Moves the ball to the impact, plus the skin so the overlap registers
+    void stop_at_impact(Ball *ball, Vec2f from, Vec2f to, float t) {
+        float distance = from.dst(to);
+        from.interpolate(to, std::min(1.0f, t + SWEEP_SKIN / distance));
+        ball->position = from;
+    }
+    // Continuous collision. Balls that moved far enough to skip past thin bodies are
+    // stopped at their earliest time of impact before the contact kernels run.
+    void sweep_fast_balls(float timeTook) {
+        swept.clear();
+        // In object order rather than store order, since stopping one ball changes what the
+        // next ones hit, and the store reorders itself as balls sleep and wake
+        for (auto &obj : objects) {
+            if (obj->type != SHAPE_BALL || ((Ball*) obj)->sleeping) continue;
+            Ball *ball = (Ball*) obj;
+            // A respawned ball never crossed the space between where it was and where it is
+            if (ball->teleported) continue;
+            Vec2f from = ball->previousPosition, to = ball->position;
+            float limit = ball->radius * SWEEP_FRACTION;
+            if (from.dst2(to) < limit * limit) continue;
+            
+            // Bounds cover the whole motion
+            candidates.clear();
+            query_near(ball, ball->bounds(), candidates);
+            float t = earliest_impact(ball, from, to, true);
+            if (t >= 1) continue;
+            
+            stop_at_impact(ball, from, to, t);
+            swept.push_back({ ball, (1 - t) * timeTook });
+        }
+        stats.sweptBalls = swept.size();
+    }
+    // Second sub-step: swept balls travel the rest of the step with the velocity
+    // the contacts left them, stopping again at anything in the way
+    void finish_swept_balls() {
+        for (auto &s : swept) {
+            Ball *ball = s.ball;
+            Vec2f from = ball->position;
+            Vec2f to = { from.x + ball->vel.x * s.remaining, from.y + ball->vel.y * s.remaining };
+            if (from.dst2(to) == 0) continue;
+            
+            AABB reach = { std::min(from.x, to.x) - ball->radius, std::min(from.y, to.y) - ball->radius,
+                           std::max(from.x, to.x) + ball->radius, std::max(from.y, to.y) + ball->radius };
+            candidates.clear();
+            query_near(ball, reach, candidates);
+            float t = earliest_impact(ball, from, to, false);
+            if (t >= 1) ball->position = to;
+            else stop_at_impact(ball, from, to, t);
+        }
+    }
+    
+    // Runs the narrow phase on every candidate pair in parallel and gathers the pairs that
+    // touch, in pair order, with the solver's inputs filled in
+    void collide_contacts() {
+        int count = contacts.size();
+        pairManifolds.resize(count);
+        contactCollided.assign(count, 0);
+        int chunks = (count + CONTACT_CHUNK - 1) / CONTACT_CHUNK;
+        // Timing every kernel call costs about as much as a cheap kernel, so only when profiling
+        bool timed = Profiler::enabled();
+        if (timed) chunkTimes.assign(chunks, ContactTimes{});
+        workers->run(chunks, [&](int chunk) {
+            PROFILE_SCOPE("collide contacts");
+            int last = std::min(count, (chunk + 1) * CONTACT_CHUNK);
+            for (int i = chunk * CONTACT_CHUNK; i < last; i++) {
+                ContactPair &pair = contacts[i];
+                Manifold &m = pairManifolds[i];
+                m.a = pair.a;
+                m.b = pair.b;
+                if (timed) {
+                    Uint64 kernelStart = SDL_GetPerformanceCounter();
+                    contactCollided[i] = pair.kernel(pair.a, pair.b, m);
+                    chunkTimes[chunk].ticks[pair.a->type][pair.b->type] += SDL_GetPerformanceCounter() - kernelStart;
+                } else {
+                    contactCollided[i] = pair.kernel(pair.a, pair.b, m);
+                }
+                if (contactCollided[i]) prepare_contact(m);
+            }
+        });
+        if (timed) {
+            for (auto &t : chunkTimes) contactTimes.add(t);
+        }
+        
+        manifolds.clear();
+        for (int i = 0; i < count; i++) {
+            if (contactCollided[i]) manifolds.push_back(pairManifolds[i]);
+        }
+        stats.pairsCollided = manifolds.size();
+    }
+    static float inverse_mass(WorldObject *obj) {
+        // Sleeping balls hold still until update_sleep() wakes them
+        if (obj->type != SHAPE_BALL || ((Ball*) obj)->sleeping) return 0;
+        return 1 / ((Ball*) obj)->mass;
+    }
+    void prepare_contact(Manifold &m) {
+        m.startA = m.a->position;
+        m.startB = m.b->position;
+        m.inverseMassA = inverse_mass(m.a);
+        m.inverseMassB = inverse_mass(m.b);
+        m.impulse = contactCache.find(m.a, m.b);
+        
+        // Balls bounce off each other fully. Static shapes bounce them as much as a body of
+        // their own mass would in a head-on elastic hit.
+        float restitution = 1;
+        if (!is_dynamic(m.b->type)) restitution = std::max(0.0f, (STATIC_MASS - m.a->mass) / (STATIC_MASS + m.a->mass));
+        Vec2f velocityB = is_dynamic(m.b->type) ? ((Ball*) m.b)->vel : Vec2f{ 0, 0 };
+        float closing = (velocityB - m.a->vel).dot_prod(m.normal);
+        m.target = closing < -RESTITUTION_SPEED ? -restitution * closing : 0;
+    }
+    static void apply_impulse(Manifold &m, float impulse) {
+        Vec2f p = m.normal * impulse;
+        if (m.inverseMassA > 0) m.a->vel -= p * m.inverseMassA;
+        if (m.inverseMassB > 0) ((Ball*) m.b)->vel += p * m.inverseMassB;
+    }
+    static void push_apart(Manifold &m, float fraction) {
+        float mass = m.inverseMassA + m.inverseMassB;
+        if (mass == 0) return;
+        Vec2f movedA = m.a->position - m.startA, movedB = m.b->position - m.startB;
+        float depth = m.depth + (movedA - movedB).dot_prod(m.normal) - CONTACT_SLOP;
+        if (depth <= 0) return;
+        
+        Vec2f push = m.normal * (fraction * depth / mass);
+        if (m.inverseMassA > 0) m.a->position -= push * m.inverseMassA;
+        if (m.inverseMassB > 0) m.b->position += push * m.inverseMassB;
+    }
+    // Calls fn on every contact, batch after batch, with each batch split between the workers
+    template <typename F>
+    void for_each_contact(F fn) {
+        Manifold *all = contactBatches.manifolds.data();
+        for (int b = 0; b < contactBatches.batch_count(); b++) {
+            int start = contactBatches.batchStart[b], end = contactBatches.batchStart[b + 1];
+            if (start == end) continue;
+            
+            // The overflow batch may share bodies, so it always runs on one thread
+            bool serial = b == ContactBatches::MAX_COLORS;
+            int chunks = serial ? 1 : (end - start + CONTACT_CHUNK - 1) / CONTACT_CHUNK;
+            workers->run(chunks, [&](int chunk) {
+                int first = serial ? start : start + chunk * CONTACT_CHUNK;
+                int last = serial ? end : std::min(end, first + CONTACT_CHUNK);
+                for (int i = first; i < last; i++) fn(all[i]);
+            });
+        }
+    }
+    // Sequential impulses: the previous step's impulses are applied first, then every contact
+    // is corrected towards its target speed a few times, then the overlap is pushed out
+    void solve_contacts() {
+        for_each_contact([](Manifold &m) {
+            apply_impulse(m, m.impulse);
+        });
+        for (int iteration = 0; iteration < quality.velocityIterations; iteration++) {
+            for_each_contact([](Manifold &m) {
+                float mass = m.inverseMassA + m.inverseMassB;
+                if (mass == 0) return;
+                Vec2f velocityB = m.inverseMassB > 0 ? ((Ball*) m.b)->vel : Vec2f{ 0, 0 };
+                float closing = (velocityB - m.a->vel).dot_prod(m.normal);
+                
+                // The total impulse can only push the bodies apart
+                float impulse = std::max(0.0f, m.impulse + (m.target - closing) / mass);
+                apply_impulse(m, impulse - m.impulse);
+                m.impulse = impulse;
+            });
+        }
+        for (int iteration = 0; iteration < quality.positionIterations; iteration++) {
+            for_each_contact([](Manifold &m) {
+                push_apart(m, POSITION_FRACTION);
+            });
+        }
+        // A falling pile pushes its bottom balls through the floor faster than the passes above
+        // spread the load, so static shapes get the last word
+        for_each_contact([](Manifold &m) {
+            if (is_dynamic(m.b->type) || m.inverseMassA == 0) return;
+            
+            float closing = -m.a->vel.dot_prod(m.normal);
+            if (closing < m.target) {
+                m.impulse += (m.target - closing) / m.inverseMassA;
+                m.a->vel -= m.normal * (m.target - closing);
+            }
+            push_apart(m, 1);
+        });
+        
+        // Each body remembers the contact that pushed it hardest, which is what it stands on
+        strongest.assign(objects.size(), -1);
+        for (auto &m : contactBatches.manifolds) {
+            if (m.impulse > strongest[m.a->index]) {
+                strongest[m.a->index] = m.impulse;
+                m.a->colliding = m.b;
+            }
+            if (m.b->type == SHAPE_BALL && m.impulse > strongest[m.b->index]) {
+                strongest[m.b->index] = m.impulse;
+                ((Ball*) m.b)->colliding = m.a;
+            }
+        }
+        contactCache.store(contactBatches.manifolds);
+    }
+    // Puts contact islands to sleep once all their balls have been resting for SLEEP_DELAY,
+    // and wakes sleeping balls hit by moving ones
+    void update_sleep(float timeTook) {
+        islands.reset(objects.size());
+        for (auto &m : manifolds) {
+            if (m.a->type != SHAPE_BALL || m.b->type != SHAPE_BALL) continue;
+            
+            Ball *a = (Ball*) m.a, *b = (Ball*) m.b;
+            if (a->sleeping != b->sleeping) {
+                Ball *awake = a->sleeping ? b : a;
+                if (awake->restTime == 0) ballStore.wake(a->sleeping ? a : b);
+            }
+            islands.unite(a->index, b->index);
+        }
+        constraints.unite(islands);
+        
+        for (int i = 0; i < ballStore.awake_count(); i++) {
+            Ball *b = ballStore.at(i);
+            if (b->position.dst2(b->restAnchor) < SLEEP_DISTANCE * SLEEP_DISTANCE) {
+                b->restTime += timeTook;
+            } else {
+                b->restAnchor = b->position;
+                b->restTime = 0;
+            }
+        }
+        
+        islandReady.assign(objects.size(), 1);
+        float far2 = quality.farDistance * quality.farDistance;
+        for (int i = 0; i < ballStore.size(); i++) {
+            Ball *b = ballStore.at(i);
+            float delay = far2 > 0 && b->position.dst2(camera) > far2 ? FAR_SLEEP_DELAY : SLEEP_DELAY;
+            if (!b->canSleep || (!b->sleeping && b->restTime < delay)) {
+                islandReady[islands.find(b->index)] = 0;
+            }
+        }
+        // Backwards, since sleeping swaps a ball to the end of the awake range
+        for (int i = ballStore.awake_count() - 1; i >= 0; i--) {
+            Ball *b = ballStore.at(i);
+            if (islandReady[islands.find(b->index)]) ballStore.sleep(b);
+        }
+        stats.sleepingBalls = ballStore.size() - ballStore.awake_count();
+    }
+    // Wakes the sleeping balls touching an object about to be removed, and every sleeping ball
+    // standing on them or tied to them, since nothing would make them fall otherwise
+    void wake_resting_on(WorldObject *obj) {
+        if (ballStore.awake_count() == ballStore.size()) return;
+        AABB reach = obj->bounds();
+        reach = { reach.minX - SLEEP_DISTANCE, reach.minY - SLEEP_DISTANCE, reach.maxX + SLEEP_DISTANCE, reach.maxY + SLEEP_DISTANCE };
+        
+        // Sleeping balls form islands through what they last stood on
+        islands.reset(objects.size());
+        for (int i = ballStore.awake_count(); i < ballStore.size(); i++) {
+            Ball *b = ballStore.at(i);
+            if (b->colliding != nullptr && b->colliding->type == SHAPE_BALL) islands.unite(b->index, b->colliding->index);
+        }
+        constraints.unite(islands);
+        
+        islandWoken.assign(objects.size(), 0);
+        for (int i = ballStore.awake_count(); i < ballStore.size(); i++) {
+            Ball *b = ballStore.at(i);
+            if (b->colliding == obj || b->bounds().overlaps(reach)) islandWoken[islands.find(b->index)] = 1;
+        }
+        // Waking swaps a ball with the first sleeping one, which this loop has already passed
+        for (int i = ballStore.awake_count(), count = ballStore.size(); i < count; i++) {
+            Ball *b = ballStore.at(i);
+            if (b != obj && islandWoken[islands.find(b->index)]) ballStore.wake(b);
+        }
+    }
+    void insert(WorldObject *obj) {
+        obj->index = objects.size();
+        objects.push_back(obj);
+        broadPhaseStale = true;
+        if (is_static(obj->type)) staticsStale = true;
+    }
+    // Whether restoring the snapshot only has to overwrite state, i.e. the same kinds of
+    // objects sit at the same indices and the static geometry hasn't changed
+    bool same_layout(const WorldSnapshot &snapshot) {
+        if (snapshot.bodies.size() != objects.size()) return false;
+        for (auto &obj : objects) {
+             const BodyState &s = snapshot.bodies[obj->index];
+             if (s.type != obj->type || s.levelShape != obj->levelShape) return false;
+
+             switch (obj->type) {
+                  case SHAPE_BALL:
+                       if (s.ball.radius != ((Ball*) obj)->radius) return false;
+                       break;
+                  case SHAPE_LINE: {
+                       Line *l = (Line*) obj;
+                       if (s.position.x != l->position.x || s.position.y != l->position.y ||
+                           s.line.endPosition.x != l->endPosition.x || s.line.endPosition.y != l->endPosition.y ||
+                           s.line.side != l->side) return false;
+                       break;
+                  }
+                  case SHAPE_RECTANGLE: {
+                       Rectangle *r = (Rectangle*) obj;
+                       if (s.position.x != r->position.x || s.position.y != r->position.y || s.rectangle.width != r->width ||
+                           s.rectangle.height != r->height || s.rectangle.angle != r->angle) return false;
+                       break;
+                  }
+                  case SHAPE_PENDULUM:
+                       if (s.pendulum.knob != ((Pendulum*) obj)->knob->index) return false;
+                       break;
+                  default:
+                       break;
+             }
+        }
+        return true;
+    }
+    // Replaces every object with fresh ones laid out like the snapshot,
+    // restore() then fills in their state
+    void rebuild(const WorldSnapshot &snapshot) {
+        // restore() adds the snapshot's constraints and contacts back, clearing first saves despawn searching them
+        constraints.clear();
+        contactCache.clear();
+        // Nothing sleeps, so despawning doesn't look for balls to wake
+        ballStore.wake_all();
+        while (!objects.empty()) {
+            despawn(objects.back());
+        }
+        int count = snapshot.bodies.size();
+        objects.assign(count, nullptr);
+
+        // Balls first so pendulums can take their knob
+        for (int i = 0; i < count; i++) {
+             const BodyState &s = snapshot.bodies[i];
+             if (s.type == SHAPE_BALL) objects[i] = balls.create(s.ball.sprite, s.ball.radius, s.mass);
+        }
+        for (int i = 0; i < count; i++) {
+             const BodyState &s = snapshot.bodies[i];
+             switch (s.type) {
+                  case SHAPE_LINE: {
+                       Line *l = lines.create(s.position, s.line.endPosition);
+                       l->side = s.line.side;
+                       l->bake();
+                       objects[i] = l;
+                       break;
+                  }
+                  case SHAPE_RECTANGLE: {
+                       Rectangle *r = rectangles.create(s.rectangle.sprite, s.rectangle.width, s.rectangle.height, 0.0f);
+                       r->angle = s.rectangle.angle;
+                       r->place(s.position.x, s.position.y);
+                       r->bake();
+                       objects[i] = r;
+                       break;
+                  }
+                  case SHAPE_PENDULUM:
+                       objects[i] = pendulums.create(s.pendulum.length, (Ball*) objects[s.pendulum.knob]);
+                       break;
+                  default:
+                       break;
+             }
+        }
+        for (int i = 0; i < count; i++) {
+             objects[i]->index = i;
+             objects[i]->levelShape = snapshot.bodies[i].levelShape;
+             if (objects[i]->type == SHAPE_BALL) ballStore.add((Ball*) objects[i]);
+        }
+        staticsStale = true;
+        broadPhaseStale = true;
+        
+        // The next stream() claims the rebuilt level shapes again and drops the ones no chunk around the camera lists
+        streamedShapes.clear();
+        spawnedShapes.clear();
+        activeChunks.clear();
+        for (auto &obj : objects) {
+             if (obj->levelShape < 0) continue;
+             if (is_static(obj->type)) streamedShapes[obj->levelShape] = { obj, 0 };
+             else spawnedShapes.insert(obj->levelShape);
+        }
+        streamOrphans = true;
+    }
+    static long long chunk_key(int x, int y) {
+        return (long long) (((unsigned long long) (unsigned int) y << 32) | (unsigned int) x);
+    }
+    WorldObject *spawn_shape(const LevelShape &s, unsigned int id) {
+        const char *sprite = s.texture >= 0 ? level.texture_name(s.texture) : "";
+        WorldObject *obj = nullptr;
+        switch (s.type) {
+             case SHAPE_BALL:
+                  obj = add_ball(s.position.x, s.position.y, sprite, s.radius, s.mass, (int) id == level.player());
+                  break;
+             case SHAPE_LINE:
+                  obj = add_line(s.position.x, s.position.y, s.endPosition.x, s.endPosition.y, s.side);
+                  break;
+             case SHAPE_RECTANGLE:
+                  obj = add_rectangle(sprite, s.position.x, s.position.y, s.width, s.height, s.angle);
+                  break;
+             case SHAPE_PENDULUM:
+                  obj = add_pendulum(create_ball(sprite, s.radius, s.mass), s.position.x, s.position.y, s.length);
+                  break;
+             default:
+                  return nullptr;
+        }
+        obj->levelShape = id;
+        return obj;
+    }
+    AABB chunk_area(const LevelChunk *chunk) {
+        float size = level.chunk_size();
+        return { chunk->x * size, chunk->y * size, (chunk->x + 1) * size, (chunk->y + 1) * size };
+    }
+    static bool contains(const AABB &area, Vec2f p) {
+        return p.x >= area.minX && p.x < area.maxX && p.y >= area.minY && p.y < area.maxY;
+    }
+    // Whether p isn't inside a level chunk that is unloaded, where balls are parked
+    bool resident(Vec2f p) {
+        if (!level.is_open()) return true;
+        float size = level.chunk_size();
+        int x = (int) floor(p.x / size), y = (int) floor(p.y / size);
+        return activeChunks.count(chunk_key(x, y)) || level.find(x, y) == nullptr;
+    }
+    void load_chunk(const LevelChunk *chunk) {
+        const unsigned int *references = level.references_of(chunk);
+        for (unsigned int i = 0; i < chunk->referenceCount; i++) {
+             unsigned int id = references[i];
+             const LevelShape *s = level.shape(id);
+             if (s == nullptr) continue;
+             
+             if (is_static(s->type)) {
+                 auto found = streamedShapes.find(id);
+                 if (found != streamedShapes.end()) found->second.chunks++;
+                 else streamedShapes[id] = { spawn_shape(*s, id), 1 };
+             } else if (spawnedShapes.insert(id).second) {
+                 spawn_shape(*s, id);
+             }
+        }
+        // Balls spawned by code that were put to sleep when the area unloaded
+        AABB area = chunk_area(chunk);
+        for (int i = ballStore.size() - 1; i >= 0; i--) {
+             Ball *b = ballStore.at(i);
+             if (b->levelShape < 0 && b->canSleep && contains(area, b->position)) ballStore.wake(b);
+        }
+        activeChunks[chunk_key(chunk->x, chunk->y)] = chunk;
+        streamStats.chunkLoads++;
+    }
+    void unload_chunk(const LevelChunk *chunk) {
+        const unsigned int *references = level.references_of(chunk);
+        for (unsigned int i = 0; i < chunk->referenceCount; i++) {
+             auto found = streamedShapes.find(references[i]);
+             if (found == streamedShapes.end()) continue;
+             // Despawning erases the entry
+             if (--found->second.chunks <= 0) despawn(found->second.object);
+        }
+        
+        // Level balls and pendulums in the area are dropped and spawn again from the file when
+        // it comes back. Balls spawned by code can't be, so they sleep with nothing to stand on.
+        // Parked after every despawn, which wakes whatever rested on the shapes that left.
+        AABB area = chunk_area(chunk);
+        leavingShapes.clear();
+        for (auto &obj : objects) {
+             if (obj == player || !contains(area, obj->position)) continue;
+             if (obj->levelShape >= 0 && !is_static(obj->type)) leavingShapes.push_back(obj);
+        }
+        for (auto &obj : leavingShapes) {
+             spawnedShapes.erase(obj->levelShape);
+             despawn(obj);
+        }
+        for (auto &obj : objects) {
+             if (obj == player || !contains(area, obj->position)) continue;
+             if (obj->type == SHAPE_BALL && ((Ball*) obj)->canSleep) ballStore.sleep((Ball*) obj);
+        }
+        activeChunks.erase(chunk_key(chunk->x, chunk->y));
+        streamStats.chunkUnloads++;
+    }
+    // Requests the textures a chunk uses
+    void prefetch_chunk(const LevelChunk *chunk) {
+        const unsigned int *references = level.references_of(chunk);
+        for (unsigned int i = 0; i < chunk->referenceCount; i++) {
+             const LevelShape *s = level.shape(references[i]);
+             if (s != nullptr && s->texture >= 0) Assets::get().request(level.texture_name(s->texture));
+        }
+    }
+    // Loads the chunks around the camera and ahead of the player, unloads the ones left behind
+    void stream() {
+        if (!level.is_open()) return;
+        float size = level.chunk_size();
+        
+        // The screen plus a chunk on every side, stretched towards where the player is heading
+        Vec2f ahead = { 0, 0 };
+        if (player != nullptr) {
+            ahead = { player->vel.x * STREAM_LOOKAHEAD, player->vel.y * STREAM_LOOKAHEAD };
+            float reach = ahead.len();
+            if (reach > size * 4) ahead.multiply(size * 4 / reach);
+        }
+        float cx = camera.x, cy = camera.y;
+        float reachX = SCREEN_WIDTH / 2 + size, reachY = SCREEN_HEIGHT / 2 + size;
+        int x0 = (int) floor((std::min(cx, cx + ahead.x) - reachX) / size);
+        int y0 = (int) floor((std::min(cy, cy + ahead.y) - reachY) / size);
+        int x1 = (int) floor((std::max(cx, cx + ahead.x) + reachX) / size);
+        int y1 = (int) floor((std::max(cy, cy + ahead.y) + reachY) / size);
+        
+        // Chunks are kept until they are one more chunk away, so moving along a border doesn't thrash
+        leaving.clear();
+        for (auto &active : activeChunks) {
+             const LevelChunk *c = active.second;
+             if (c->x < x0 - 1 || c->x > x1 + 1 || c->y < y0 - 1 || c->y > y1 + 1) leaving.push_back(c);
+        }
+        for (auto &c : leaving) {
+             unload_chunk(c);
+        }
+        for (int y = y0; y <= y1; y++) {
+            for (int x = x0; x <= x1; x++) {
+                if (activeChunks.count(chunk_key(x, y))) continue;
+                const LevelChunk *c = level.find(x, y);
+                if (c != nullptr) load_chunk(c);
+            }
+        }
+        // Textures are requested one chunk further out, so they are decoded before their shapes show up
+        for (int y = y0 - 1; y <= y1 + 1; y++) {
+            for (int x = x0 - 1; x <= x1 + 1; x++) {
+                if (!prefetchedChunks.insert(chunk_key(x, y)).second) continue;
+                const LevelChunk *c = level.find(x, y);
+                if (c != nullptr) prefetch_chunk(c);
+            }
+        }
+        if (streamOrphans) {
+            leavingShapes.clear();
+            for (auto &shape : streamedShapes) {
+                 if (shape.second.chunks <= 0) leavingShapes.push_back(shape.second.object);
+            }
+            for (auto &obj : leavingShapes) {
+                 despawn(obj);
+            }
+            streamOrphans = false;
+        }
+        if (uploadsTextures) Assets::get().update_streaming();
+        
+        streamStats.activeChunks = activeChunks.size();
+        streamStats.streamedShapes = streamedShapes.size();
+    }
+    // Draw items of every line and rectangle, in object order like the rest of the frame
+    void build_static_layer() {
+        PROFILE_SCOPE("build static layer");
+        std::vector<WorldObject*> shapes;
+        shapes.insert(shapes.end(), lines.all().begin(), lines.all().end());
+        shapes.insert(shapes.end(), rectangles.all().begin(), rectangles.all().end());
+        std::sort(shapes.begin(), shapes.end(), [](WorldObject *a, WorldObject *b) {
+            return a->index < b->index;
+        });
+        
+        std::shared_ptr<StaticLayer> layer(new StaticLayer());
+        std::vector<AABB> boxes;
+        for (auto &obj : shapes) {
+            obj->draw(layer->shapes);
+            boxes.resize(layer->shapes.size(), obj->bounds());
+        }
+        layer->build(boxes);
+        staticLayer = layer;
+        staticLayerStale = false;
+    }
+    // Dynamic objects from the spatial hash plus static shapes from the baked tree around a ball.
+    // Balls mostly stay put between steps, so the tree is only walked again once the box
+    // leaves the area covered by the ball's last walk.
+    void query_near(Ball *ball, AABB box, std::vector<int> &out) {
+        if (staticsStale) bake();
+        broadPhase.query(box, out);
+        
+        AABB &reach = ball->staticReach;
+        if (ball->staticsVersion != staticsVersion || box.minX < reach.minX || box.minY < reach.minY ||
+            box.maxX > reach.maxX || box.maxY > reach.maxY) {
+            reach = { box.minX - STATIC_MARGIN, box.minY - STATIC_MARGIN, box.maxX + STATIC_MARGIN, box.maxY + STATIC_MARGIN };
+            ball->nearbyStatics.clear();
+            staticTree.query(reach, ball->nearbyStatics);
+            ball->staticsVersion = staticsVersion;
+        }
+        for (auto &index : ball->nearbyStatics) {
+            if (objects[index]->bounds().overlaps(box)) out.push_back(index);
+        }
+    }
+    public:
+       ~Aluminium() {
+           while (!objects.empty()) {
+               despawn(objects.back());
+           }
+       }
+       // Threads used for contact resolution, including the one calling update()
+       void set_thread_count(int count) {
+           workers.reset(new WorkerPool(std::max(1, count)));
+       }
+       // Applies from the next step and frame on
+       void set_quality(Quality quality) {
+           this->quality = quality;
+           constraints.set_substeps(quality.constraintSubsteps);
+       }
+       Quality get_quality() {
+           return quality;
+       }
+       // Turn off when another thread owns the renderer and calls Assets::update_streaming itself
+       void set_uploads_textures(bool uploads) {
+           uploadsTextures = uploads;
+       }
+       CollisionStats collision_stats() {
+           return stats;
+       }
+       PhaseTimings &phase_timings() {
+           return timings;
+       }
+       int object_count() {
+           return objects.size();
+       }
+       int ball_count() {
+           return ballStore.size();
+       }
+       // Sleeping balls skip integration and broad phase queries until woken
+       void wake(Ball *ball) {
+           ballStore.wake(ball);
+       }
+       MemoryStats memory_stats() {
+           return { balls.get_stats(), lines.get_stats(), rectangles.get_stats(), pendulums.get_stats() };
+       }
+       void init() override {
+           displayName = "Aluminium";
+       } 
+       void load() override {
+           Assets::get().load(TEXTURES);
+           
+           add_ball(600, -300, "aluminium-ball", 16, 1.7, true);
+           
+           add_pendulum(create_ball("aluminium-ball", 16, 10), 1100, -110, 70);
+           add_ball(800, -1000, "wooden-ball", 16, 1.0);
+           
+           add_rope({ 1300, -260 }, { 1700, -260 }, 14, "wooden-ball", 8, 0.5f, 0.1f, true, -1);
+           add_rope({ 1900, -500 }, { 2100, -500 }, 10, "aluminium-ball", 8, 0.8f, 0, false, -1);
+            
+           add_rectangle("wooden-beam", 0, 0, 10000, 40);
+               
+           add_rectangle("wooden-plank", 500, -150, 150, 150);
+           add_rectangle("wooden-plank", 750, -150, 200, 40, -30);
+           
+           bake();
+       }
+       // Streams the level from a file instead of building the hardcoded one. Chunks around
+       // the player's spawn load right away, the rest follow the camera from update().
+       bool load_level(const char *path) {
+           if (!level.open(path)) return false;
+           
+           const LevelShape *spawn = level.player() >= 0 ? level.shape(level.player()) : nullptr;
+           if (spawn != nullptr) camera = spawn->position;
+           stream();
+           while (!Assets::get().update_streaming()) SDL_Delay(1);
+           return true;
+       }
+       // Writes the current world as a level file for load_level()
+       bool export_level(const char *path, float chunkSize) {
+           std::vector<LevelShape> shapes;
+           std::vector<std::string> textures;
+           std::unordered_map<TextureHandle, int> textureIndex;
+           auto texture = [&](TextureHandle handle) {
+               auto found = textureIndex.emplace(handle, textures.size());
+               if (found.second) textures.push_back(Assets::get().name(handle));
+               return found.first->second;
+           };
+           std::unordered_set<WorldObject*> knobs;
+           for (auto &p : pendulums.all()) {
+                knobs.insert(p->knob);
+           }
+           // Levels only know pendulums, balls held by any other constraint are left out
+           std::unordered_set<WorldObject*> held;
+           for (int i = 0; i < constraints.size(); i++) {
+                const Constraint &c = constraints.at(i);
+                for (Ball *b : { c.a, c.b, c.c }) {
+                     if (b != nullptr && !knobs.count(b)) held.insert(b);
+                }
+           }
+           if (!held.empty()) fprintf(stderr, "Level Warning: %d balls held by ropes or constraints are not saved\n", (int) held.size());
+           
+           // (chunk y, chunk x, shape)
+           std::vector<std::tuple<int, int, unsigned int>> entries;
+           int playerShape = -1;
+           for (auto &obj : objects) {
+                if (knobs.count(obj) || held.count(obj)) continue;
+                LevelShape s;
+                memset(&s, 0, sizeof(LevelShape));
+                s.type = obj->type;
+                s.texture = -1;
+                s.position = obj->position;
+                switch (obj->type) {
+                     case SHAPE_BALL: {
+                          Ball *b = (Ball*) obj;
+                          s.texture = texture(b->get_sprite());
+                          s.radius = b->radius;
+                          s.mass = b->mass;
+                          break;
+                     }
+                     case SHAPE_LINE:
+                          s.endPosition = ((Line*) obj)->endPosition;
+                          s.side = ((Line*) obj)->side;
+                          break;
+                     case SHAPE_RECTANGLE: {
+                          Rectangle *r = (Rectangle*) obj;
+                          s.texture = texture(r->get_sprite());
+                          s.width = r->width;
+                          s.height = r->height;
+                          s.angle = Utils::degrees(r->angle);
+                          break;
+                     }
+                     case SHAPE_PENDULUM: {
+                          Pendulum *p = (Pendulum*) obj;
+                          s.texture = texture(p->knob->get_sprite());
+                          s.radius = p->knob->radius;
+                          s.mass = p->knob->mass;
+                          s.length = p->length;
+                          break;
+                     }
+                     default:
+                          continue;
+                }
+                unsigned int id = shapes.size();
+                shapes.push_back(s);
+                if (obj == player) playerShape = id;
+                
+                AABB box = is_static(obj->type) ? obj->bounds() : AABB{ s.position.x, s.position.y, s.position.x, s.position.y };
+                for (int y = (int) floor(box.minY / chunkSize); y <= (int) floor(box.maxY / chunkSize); y++) {
+                    for (int x = (int) floor(box.minX / chunkSize); x <= (int) floor(box.maxX / chunkSize); x++) {
+                        entries.emplace_back(y, x, id);
+                    }
+                }
+           }
+           std::sort(entries.begin(), entries.end());
+           
+           std::vector<LevelChunk> chunks;
+           std::vector<unsigned int> references;
+           for (auto &e : entries) {
+                int y = std::get<0>(e), x = std::get<1>(e);
+                if (chunks.empty() || chunks.back().x != x || chunks.back().y != y) {
+                    chunks.push_back({ x, y, (unsigned int) references.size(), 0 });
+                }
+                references.push_back(std::get<2>(e));
+                chunks.back().referenceCount++;
+           }
+           
+           for (auto &name : textures) {
+                if (name.size() >= LEVEL_NAME_LENGTH) {
+                    fprintf(stderr, "Level Error: texture name %s is too long\n", name.c_str());
+                    return false;
+                }
+           }
+           FILE *file = fopen(path, "wb");
+           if (file == NULL) {
+               fprintf(stderr, "Level Error: cannot open %s for writing\n", path);
+               return false;
+           }
+           LevelHeader header = { { 'A', 'L', 'L', 'V' }, LevelFile::VERSION, chunkSize, (int) textures.size(), (int) shapes.size(),
+                                  (int) chunks.size(), (int) references.size(), playerShape };
+           bool written = fwrite(&header, sizeof(LevelHeader), 1, file) == 1;
+           for (auto &name : textures) {
+                char padded[LEVEL_NAME_LENGTH] = {};
+                memcpy(padded, name.c_str(), name.size());
+                written = written && fwrite(padded, LEVEL_NAME_LENGTH, 1, file) == 1;
+           }
+           written = written && fwrite(shapes.data(), sizeof(LevelShape), shapes.size(), file) == shapes.size();
+           written = written && fwrite(chunks.data(), sizeof(LevelChunk), chunks.size(), file) == chunks.size();
+           written = written && fwrite(references.data(), sizeof(unsigned int), references.size(), file) == references.size();
+           fclose(file);
+           if (!written) fprintf(stderr, "Level Error: cannot write %s\n", path);
+           return written;
+       }
+       StreamStats stream_stats() {
+           return streamStats;
+       }
+       // Builds the static shape tree. Runs after the level is loaded, and on the next
+       // query if lines or rectangles were added or removed since.
+       void bake() {
+           staticTree.build(objects);
+           staticsStale = false;
+           staticsVersion++;
+           staticLayerStale = true;
+       }
+    
+       // Any event pushes the player towards the mouse, and makes it jump while the mouse is above the middle
+       void handle_event(SDL_Event, SDL_Point pointer) override {
+           int cx = pointer.x, cy = pointer.y;
+           
+           if (player == nullptr) return;
+           
+           float f = cx > SCREEN_WIDTH / 2 ? 4 : -4;
+           wake(player);
+           player->vel.x += f;
+           
+           if (player->colliding != nullptr) {
+               if (cy < SCREEN_WIDTH / 2) {  
+                   if (player->colliding->type == SHAPE_BALL) wake((Ball*) player->colliding);
+                   player->jump(300, player->colliding);
+                   player->colliding = nullptr;
+               }
+           }
+       }
+       void update(float timeTook) override { 
+           PROFILE_SCOPE("update");
+           {
+               // Chunks come and go between steps, never during one
+               PROFILE_SCOPE("stream");
+               stream();
+           }
+           
+           Uint64 phaseStart = SDL_GetPerformanceCounter();
+           {
+               PROFILE_SCOPE("integration");
+               // Sleeping balls would never notice a change of gravity. The ones parked in
+               // unloaded chunks stay asleep, there is nothing around them to fall onto.
+               if (Vars::gravity.x != lastGravity.x || Vars::gravity.y != lastGravity.y) {
+                   for (int i = ballStore.awake_count(), count = ballStore.size(); i < count; i++) {
+                       Ball *b = ballStore.at(i);
+                       if (resident(b->position)) ballStore.wake(b);
+                   }
+                   lastGravity = Vars::gravity;
+               }
+               constraints.wake_connected(ballStore);
+               // Balls are the only bodies that move, pendulum pivots stay where they are placed
+               ballStore.save_previous_positions();
+               ballStore.gather();
+               ballStore.integrate(timeTook, Vars::gravity);
+               ballStore.scatter();
+           }
+           timings.integration += Utils::seconds_since(phaseStart);
+           
+           phaseStart = SDL_GetPerformanceCounter();
+           {
+               PROFILE_SCOPE("constraints");
+               // Scaled like BallStore::integrate
+               constraints.solve(timeTook, Vars::gravity * 60, *workers);
+           }
+           timings.constraints += Utils::seconds_since(phaseStart);
+           
+           phaseStart = SDL_GetPerformanceCounter();
+           if (player != nullptr) {
+               camera = player->position;
+           }
+           timings.camera += Utils::seconds_since(phaseStart);
+           
+           // Collision detection
+           phaseStart = SDL_GetPerformanceCounter();
+           {
+               PROFILE_SCOPE("broad phase");
+               broadPhase.build(ballStore.all(), objects.size());
+               broadPhaseStale = false;
+           }
+           timings.broadPhase += Utils::seconds_since(phaseStart);
+           
+           phaseStart = SDL_GetPerformanceCounter();
+           stats = CollisionStats{};
+           {
+               PROFILE_SCOPE("sweep");
+               sweep_fast_balls(timeTook);
+           }
+           {
+               PROFILE_SCOPE("find contacts");
+               contacts.clear();
+               // In object order, which unlike the store's order survives a snapshot round trip
+               for (auto &obj : objects) {
+                    if (obj->type != SHAPE_BALL || ((Ball*) obj)->sleeping) continue;
+                    Ball *ball = (Ball*) obj;
+                    
+                    candidates.clear();
+                    query_near(ball, ball->bounds(), candidates);
+                    // Sorted so the batches don't depend on the hash layout
+                    std::sort(candidates.begin(), candidates.end());
+                    
+                    for (auto &candidate : candidates) {
+                         WorldObject *other = objects[candidate];
+                         if (ball->index == other->index) continue;
+                         if (other->type == SHAPE_BALL) {
+                             Ball *ball2 = (Ball*) other;
+                             if (ball->group != 0 && ball->group == ball2->group) continue;
+                             // Each pair once: awake balls find each other, and the lower index keeps the pair
+                             if (!ball2->sleeping && ball2->index < ball->index) continue;
+                         }
+                         
+                         ContactKernel kernel = contactTable[SHAPE_BALL][other->type];
+                         if (kernel != nullptr) contacts.push_back({ ball, other, kernel });
+                    }
+               }
+               stats.pairsTested = contacts.size();
+           }
+           {
+               PROFILE_SCOPE("collide");
+               contactTimes = ContactTimes{};
+               collide_contacts();
+           }
+           {
+               PROFILE_SCOPE("batch contacts");
+               contactBatches.build(manifolds, objects.size());
+           }
+           {
+               PROFILE_SCOPE("solve contacts");
+               solve_contacts();
+               finish_swept_balls();
+           }
+           {
+               PROFILE_SCOPE("sleep");
+               update_sleep(timeTook);
+           }
+           timings.narrowPhase += Utils::seconds_since(phaseStart);
+           timings.steps++;
+           
+           if (Profiler::enabled()) {
+               [[maybe_unused]] double toUs = 1e6 / SDL_GetPerformanceFrequency();
+               for (int a = 0; a < SHAPE_COUNT; a++) {
+                   for (int b = 0; b < SHAPE_COUNT; b++) {
+                       if (contactTable[a][b] != nullptr) PROFILE_COUNTER(contactNames[a][b], contactTimes.ticks[a][b] * toUs);
+                   }
+               }
+               PROFILE_COUNTER("contacts", stats.pairsTested);
+               PROFILE_COUNTER("awake balls", ballStore.awake_count());
+           }
+       }
+       // Records everything the camera can see after the latest step
+       void prepare_frame(RenderFrame &frame) override {
+           PROFILE_SCOPE("prepare frame");
+           frame.clear();
+           frame.cameraFrom = frame.cameraTo = camera;
+           if (player != nullptr) {
+               frame.cameraFrom = player->drawn_from();
+               frame.cameraTo = player->position;
+           }
+           
+           // Visibility pass: only objects whose bounds reach the camera get drawn.
+           // The margin covers interpolation between the previous and the latest step.
+           const float margin = 64;
+           SDL_Rect v = Utils::get_viewport_rect();
+           float left = camera.x - SCREEN_WIDTH / 2 + v.x;
+           float top = camera.y - SCREEN_HEIGHT / 2 + v.y;
+           AABB view = { left - margin, top - margin, left + v.w + margin, top + v.h + margin };
+           
+           if (broadPhaseStale) {
+               broadPhase.build(ballStore.all(), objects.size());
+               broadPhaseStale = false;
+           }
+           if (staticsStale) bake();
+           if (staticLayerStale) build_static_layer();
+           frame.statics = staticLayer;
+           // Ropes and rods go under the balls they hold
+           if (quality.drawJoints) constraints.draw(view, frame.items);
+           visible.clear();
+           broadPhase.query(view, visible);
+           // Object order is draw order
+           std::sort(visible.begin(), visible.end());
+           for (auto &index : visible) {
+                objects[index]->draw(frame.items);
+           }
+       }
+       void render(float alpha) override {
+           PROFILE_SCOPE("render");
+           prepare_frame(frame);
+           auto lock = Assets::get().lock_sprites();
+           frame.draw(alpha);
+       }
+       Line *add_line(float x1, float y1, float x2, float y2) {
+           return add_line(x1, y1, x2, y2, 0);
+       }
+       Line *add_line(float x1, float y1, float x2, float y2, int pointing) {
+           Line *line = lines.create(Vec2f{x1, y1}, Vec2f{x2, y2});
+           line->side = pointing;
+           line->bake();
+           
+           insert(line);
+           return line;
+       }
+       
+       Ball *add_ball(float x, float y, const char *spriteName, float radius, float mass) {
+           return add_ball(x, y, spriteName, radius, mass, false);
+       }
+       Ball *add_ball(float x, float y, const char *spriteName, float radius, float mass, bool isPlayer) {
+           Ball *ball = balls.create(spriteName, radius, mass);
+           ball->place(x, y);
+           if (isPlayer) {
+               player = ball;
+           }
+           insert(ball);
+           ballStore.add(ball);
+           return ball;
+       }
+       // The knob must come from create_ball() and is owned by the pendulum from then on
+       Pendulum *add_pendulum(Ball *ball, float x, float y, float length) {
+           Pendulum *p = pendulums.create(length, ball);
+           p->position.x = x;
+           p->position.y = y;
+           p->place({x, y});
+           p->add(objects);
+           ballStore.add(ball);
+           add_pin(ball, { x, y }, length, 0);
+           
+           insert(p);
+           return p;
+       }
+       // Keeps two balls length apart. A compliance above 0 lets them stretch like a spring.
+       void add_distance(Ball *a, Ball *b, float length, float compliance) {
+           constraints.add({ CONSTRAINT_DISTANCE, a, b, nullptr, { 0, 0 }, length, compliance });
+       }
+       // Keeps the ball length away from a fixed point, 0 nails it there
+       void add_pin(Ball *ball, Vec2f anchor, float length, float compliance) {
+           constraints.add({ CONSTRAINT_PIN, ball, nullptr, nullptr, anchor, length, compliance });
+       }
+       // Holds the angle from a around the hinge ball to c where it is now
+       void add_hinge(Ball *a, Ball *hinge, Ball *c, float compliance) {
+           Vec2f u = a->position - hinge->position, v = c->position - hinge->position;
+           float angle = atan2(u.cross_prod(v), u.dot_prod(v));
+           constraints.add({ CONSTRAINT_HINGE, a, hinge, c, { 0, 0 }, angle, compliance });
+       }
+       // Rope of balls laid out straight from one point to another, slack times longer than that
+       // distance so it can sag. Chains pin only the start, rope bridges both ends. Hinges stiffen
+       // it against bending unless bendCompliance is below 0.
+       // Returns the first link, the rest follow it in the object list.
+       Ball *add_rope(Vec2f from, Vec2f to, int links, const char *spriteName, float radius, float mass,
+                      float slack, bool pinEnd, float bendCompliance) {
+           if (links < 2) {
+               fprintf(stderr, "Rope Error: a rope needs at least 2 links\n");
+               return nullptr;
+           }
+           int group = ++ropeGroups;
+           float spacing = from.dst(to) * (1 + slack) / (links - 1);
+           Ball *first = nullptr, *previous = nullptr, *beforePrevious = nullptr;
+           for (int i = 0; i < links; i++) {
+               Vec2f p = from;
+               p.interpolate(to, (float) i / (links - 1));
+               Ball *link = add_ball(p.x, p.y, spriteName, radius, mass);
+               link->group = group;
+               
+               if (previous == nullptr) first = link;
+               else add_distance(previous, link, spacing, 0);
+               if (beforePrevious != nullptr && bendCompliance >= 0) add_hinge(beforePrevious, previous, link, bendCompliance);
+               beforePrevious = previous;
+               previous = link;
+           }
+           add_pin(first, from, 0, 0);
+           if (pinEnd) add_pin(previous, to, 0, 0);
+           return first;
+       }
+       int constraint_count() {
+           return constraints.size();
+       }
+       Ball *create_ball(const char *spriteName, float radius, float mass) {
+           return balls.create(spriteName, radius, mass);
+       }
+       Rectangle *add_rectangle(const char *spriteName, float centerX, float centerY, float width, float height, float angle) {
+           Rectangle *r = rectangles.create(spriteName, width, height, angle);
+           r->place(centerX, centerY);
+           r->bake();
+           
+           insert(r);
+           return r;
+       }
+       Rectangle *add_rectangle(const char *spriteName, float centerX, float centerY, float width, float height) {
+           return add_rectangle(spriteName, centerX, centerY, width, height, 0);
+       }
+       // Removes an object from the world and returns its slot to the pool.
+       // Pendulums take their knob with them, and removing a knob removes its pendulum.
+       // Must not be called while update() is running.
+       void despawn(WorldObject *obj) {
+           if (obj->type == SHAPE_BALL) {
+               for (auto &p : pendulums.all()) {
+                    if (p->knob == obj) {
+                        despawn(p);
+                        return;
+                    }
+               }
+           }
+           
+           wake_resting_on(obj);
+           
+           // Swap with the last object so the list stays dense
+           WorldObject *last = objects.back();
+           objects[obj->index] = last;
+           last->index = obj->index;
+           objects.pop_back();
+           broadPhaseStale = true;
+           staticsVersion++;
+           if (is_static(obj->type)) staticsStale = true;
+           if (obj->levelShape >= 0 && is_static(obj->type)) streamedShapes.erase(obj->levelShape);
+           
+           for (auto &b : ballStore.all()) {
+                if (b->colliding == obj) b->colliding = nullptr;
+           }
+           contactCache.forget(obj);
+           
+           switch (obj->type) {
+                case SHAPE_BALL:
+                     if (obj == player) player = nullptr;
+                     constraints.remove_body((Ball*) obj);
+                     ballStore.remove((Ball*) obj);
+                     balls.destroy((Ball*) obj);
+                     break;
+                case SHAPE_LINE:
+                     lines.destroy((Line*) obj);
+                     break;
+                case SHAPE_RECTANGLE:
+                     rectangles.destroy((Rectangle*) obj);
+                     break;
+                case SHAPE_PENDULUM: {
+                     Ball *knob = ((Pendulum*) obj)->knob;
+                     pendulums.destroy((Pendulum*) obj);
+                     // The knob no longer has a pendulum pointing at it
+                     despawn(knob);
+                     break;
+                }
+                default:
+                     break;
+           }
+       }
+       // Copies the whole simulation state into the snapshot
+       void capture(WorldSnapshot &snapshot) {
+           snapshot.bodies.resize(objects.size());
+           for (auto &obj : objects) {
+                BodyState &s = snapshot.bodies[obj->index];
+                // Padding too, so equal worlds give equal bytes
+                memset(&s, 0, sizeof(BodyState));
+                s.type = obj->type;
+                s.colliding = -1;
+                s.levelShape = obj->levelShape;
+                s.position = obj->position;
+                s.previousPosition = obj->previousPosition;
+
+                switch (obj->type) {
+                     case SHAPE_BALL: {
+                          Ball *b = (Ball*) obj;
+                          s.colliding = b->colliding != nullptr ? b->colliding->index : -1;
+                          s.mass = b->mass;
+                          s.resistance = b->resistance;
+                          s.vel = b->vel;
+                          s.acceleration = b->acceleration;
+                          s.ball = { b->get_sprite(), b->radius, b->restTime, b->restAnchor, b->sleeping, b->canSleep, b->group };
+                          break;
+                     }
+                     case SHAPE_LINE: {
+                          Line *l = (Line*) obj;
+                          s.line = { l->endPosition, l->side };
+                          break;
+                     }
+                     case SHAPE_RECTANGLE: {
+                          Rectangle *r = (Rectangle*) obj;
+                          s.rectangle = { r->get_sprite(), r->width, r->height, r->angle };
+                          break;
+                     }
+                     case SHAPE_PENDULUM: {
+                          Pendulum *p = (Pendulum*) obj;
+                          s.pendulum = { p->knob->index, p->length };
+                          break;
+                     }
+                     default:
+                          break;
+                }
+           }
+           snapshot.constraints.resize(constraints.size());
+           for (int i = 0; i < constraints.size(); i++) {
+                const Constraint &c = constraints.at(i);
+                snapshot.constraints[i] = { c.type, c.a->index, c.b != nullptr ? c.b->index : -1, c.c != nullptr ? c.c->index : -1,
+                      c.anchor, c.rest, c.compliance };
+           }
+           snapshot.contacts.resize(contactCache.size());
+           for (int i = 0; i < contactCache.size(); i++) {
+                auto &c = contactCache.at(i);
+                snapshot.contacts[i] = { c.a->index, c.b->index, c.impulse };
+           }
+           snapshot.player = player != nullptr ? player->index : -1;
+           snapshot.camera = camera;
+           snapshot.gravity = Vars::gravity;
+           snapshot.lastGravity = lastGravity;
+       }
+       // Puts the world back into a captured state. When objects were spawned or despawned
+       // since the capture, the world is rebuilt from the snapshot and earlier pointers to
+       // its objects must not be used anymore.
+       void restore(const WorldSnapshot &snapshot) {
+           if (!same_layout(snapshot)) rebuild(snapshot);
+
+           for (auto &obj : objects) {
+                const BodyState &s = snapshot.bodies[obj->index];
+                // Moving between the sleeping and awake partitions touches the velocity
+                if (obj->type == SHAPE_BALL) {
+                    Ball *b = (Ball*) obj;
+                    if (s.ball.sleeping) ballStore.sleep(b);
+                    else ballStore.wake(b);
+                    b->restTime = s.ball.restTime;
+                    b->restAnchor = s.ball.restAnchor;
+                    b->canSleep = s.ball.canSleep;
+                    b->group = s.ball.group;
+                    ropeGroups = std::max(ropeGroups, b->group);
+                    b->colliding = s.colliding >= 0 ? objects[s.colliding] : nullptr;
+                    b->mass = s.mass;
+                    b->resistance = s.resistance;
+                    b->vel = s.vel;
+                    b->acceleration = s.acceleration;
+                    // Until the next step, so the frame after a restore doesn't streak from where the ball was
+                    b->teleported = true;
+                }
+                obj->levelShape = s.levelShape;
+                obj->position = s.position;
+                obj->previousPosition = s.previousPosition;
+
+                if (obj->type == SHAPE_PENDULUM) ((Pendulum*) obj)->length = s.pendulum.length;
+           }
+           constraints.clear();
+           auto ball = [this](int index) {
+               return index >= 0 ? (Ball*) objects[index] : nullptr;
+           };
+           for (auto &c : snapshot.constraints) {
+                constraints.add({ (ConstraintType) c.type, ball(c.a), ball(c.b), ball(c.c), c.anchor, c.rest, c.compliance });
+           }
+           contactCache.clear();
+           for (auto &c : snapshot.contacts) {
+                contactCache.add(objects[c.a], objects[c.b], c.impulse);
+           }
+           contactCache.sort();
+           player = snapshot.player >= 0 ? (Ball*) objects[snapshot.player] : nullptr;
+           camera = snapshot.camera;
+           Vars::gravity = snapshot.gravity;
+           lastGravity = snapshot.lastGravity;
+           broadPhaseStale = true;
+       }
+       WorldObject *object_at(int index) {
+           return objects[index];
+       }
+       Ball *get_player() {
+           return player;
+       }
+};
+
+#endif
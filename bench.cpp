@@ -0,0 +1,418 @@
+// Microbenchmarks of the simulation core over randomized inputs of growing size.
+// Every measurement is printed as one JSON object per line, and hit counts depend only on
+// the seed, so the output of two releases can be diffed line by line.
+#include "aluminium.h"
+#include "benchmark.h"
+
+// Random shapes near random balls, about half of them touching
+struct PairScene {
+    ObjectPool<Ball> balls;
+    ObjectPool<Line> lines;
+    ObjectPool<Rectangle> rectangles;
+    std::vector<Ball*> a, b;
+    std::vector<Line*> segments;
+    std::vector<Rectangle*> boxes;
+    // Motion of the balls over one step, for the swept tests
+    std::vector<Vec2f> from, to;
+
+    PairScene(int count, std::mt19937 &rng) {
+        auto range = [&rng](float min, float max) {
+            return std::uniform_real_distribution<float>(min, max)(rng);
+        };
+        auto around = [&](Vec2f center, float distance) {
+            float angle = range(0, 2 * Trig::PI);
+            return center + Vec2f{ cosf(angle), sinf(angle) } * distance;
+        };
+        // Scattered wide enough that neighbouring pairs don't share cache lines of state
+        float extent = 100.0f * sqrtf(count);
+        for (int i = 0; i < count; i++) {
+            Vec2f p = { range(-extent, extent), range(-extent, extent) };
+            float radius = range(8, 32);
+            Ball *ball = balls.create("wooden-ball", radius, 1.0f);
+            ball->place(p.x, p.y);
+            ball->previousPosition = around(p, range(0, radius));
+            a.push_back(ball);
+
+            float otherRadius = range(8, 32);
+            Vec2f q = around(p, range(0, 2 * (radius + otherRadius)));
+            Ball *other = balls.create("aluminium-ball", otherRadius, 1.7f);
+            other->place(q.x, q.y);
+            other->previousPosition = q;
+            b.push_back(other);
+
+            Vec2f center = around(p, range(0, 2 * radius));
+            Vec2f half = around({ 0, 0 }, range(25, 100));
+            Line *line = lines.create(center - half, center + half);
+            line->side = i % 2;
+            line->bake();
+            segments.push_back(line);
+
+            float width = range(40, 200), height = range(20, 80);
+            Vec2f corner = around(p, range(0, radius + (width + height) / 2)) - Vec2f{ width / 2, height / 2 };
+            Rectangle *rect = rectangles.create("wooden-plank", width, height, range(-45, 45));
+            rect->place(corner.x, corner.y);
+            rect->bake();
+            boxes.push_back(rect);
+
+            from.push_back(p - around({ 0, 0 }, range(0, 400)));
+            to.push_back(p);
+        }
+    }
+};
+
+static void print_time(const char *suite, const char *name, int count, double ns) {
+    printf("{\"suite\": \"%s\", \"case\": \"%s\", \"n\": %d, \"ns_per_op\": %.3f}\n", suite, name, count, ns);
+}
+static void print_hits(const char *suite, const char *name, int count, double ns, int hits) {
+    printf("{\"suite\": \"%s\", \"case\": \"%s\", \"n\": %d, \"ns_per_op\": %.3f, \"hits\": %d}\n", suite, name, count, ns, hits);
+}
+// Printing what the timed loops accumulated keeps them from being optimized away
+static void print_checksum(const char *suite, int count, double checksum) {
+    printf("{\"suite\": \"%s\", \"case\": \"checksum\", \"n\": %d, \"checksum\": %g}\n", suite, count, checksum);
+}
+
+// Ball::collision, the overlap tests the old narrow phase and the sweeps build on
+static void bench_collision(int count, std::mt19937 &rng) {
+    PairScene scene(count, rng);
+    int hits = 0;
+    double ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += scene.a[i]->collision(scene.segments[i]).collided;
+    });
+    print_hits("collision", "ball_line", count, ns, hits);
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += scene.a[i]->collision(scene.boxes[i]).collided;
+    });
+    print_hits("collision", "ball_rectangle", count, ns, hits);
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += scene.a[i]->collision(scene.b[i]).collided;
+    });
+    print_hits("collision", "ball_ball", count, ns, hits);
+}
+
+// The narrow phase kernels as the world calls them, through the contact table
+static void bench_contact(int count, std::mt19937 &rng) {
+    PairScene scene(count, rng);
+    Manifold m;
+    int hits = 0;
+    ContactKernel kernel = contactTable[SHAPE_BALL][SHAPE_LINE];
+    double ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += kernel(scene.a[i], scene.segments[i], m);
+    });
+    print_hits("contact", "ball_line", count, ns, hits);
+    kernel = contactTable[SHAPE_BALL][SHAPE_RECTANGLE];
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += kernel(scene.a[i], scene.boxes[i], m);
+    });
+    print_hits("contact", "ball_rectangle", count, ns, hits);
+    kernel = contactTable[SHAPE_BALL][SHAPE_BALL];
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += kernel(scene.a[i], scene.b[i], m);
+    });
+    print_hits("contact", "ball_ball", count, ns, hits);
+}
+
+// Time of impact of fast balls, from the previous position to the current one
+static void bench_sweep(int count, std::mt19937 &rng) {
+    PairScene scene(count, rng);
+    float t;
+    int hits = 0;
+    double ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) {
+            Line *l = scene.segments[i];
+            hits += Sweep::circle_segment(scene.from[i], scene.to[i], scene.a[i]->radius, l->position, l->endPosition, t);
+        }
+    });
+    print_hits("sweep", "ball_line", count, ns, hits);
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) hits += Sweep::circle_rectangle(scene.from[i], scene.to[i], scene.a[i]->radius, scene.boxes[i], t);
+    });
+    print_hits("sweep", "ball_rectangle", count, ns, hits);
+    ns = Benchmark::time_kernel(count, [&] {
+        hits = 0;
+        for (int i = 0; i < count; i++) {
+            Ball *other = scene.b[i];
+            hits += Sweep::circle_circle(scene.from[i], scene.to[i], scene.a[i]->radius,
+                                         other->previousPosition, other->position, other->radius, t);
+        }
+    });
+    print_hits("sweep", "ball_ball", count, ns, hits);
+}
+
+// The packed ball integration kernel, per ball
+static void bench_integration(int count, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> range(-1000, 1000);
+    std::vector<float> x(count), y(count), vx(count), vy(count), ax(count), ay(count);
+    std::vector<float> resistance(count, 0.85f);
+    for (int i = 0; i < count; i++) {
+        x[i] = range(rng);
+        y[i] = range(rng);
+        vx[i] = range(rng);
+        vy[i] = range(rng);
+    }
+    double ns = Benchmark::time_kernel(count, [&] {
+        integrate_balls(x.data(), y.data(), vx.data(), vy.data(), ax.data(), ay.data(), resistance.data(), count,
+                        Vars::gravity.x * 60, Vars::gravity.y * 60, FIXED_TIMESTEP);
+    });
+    print_time("integration", "integrate_balls", count, ns);
+}
+
+// Per-ball loops over Ball objects, the way the world runs them, against the same loops over
+// dense per-component arrays indexed by entity. Balls are visited in a shuffled order, like
+// the store and object lists end up in after churn and sleeping.
+static void bench_layout(int count, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> range(-1000, 1000);
+    ObjectPool<Ball> pool;
+    std::vector<Ball*> balls;
+    for (int i = 0; i < count; i++) {
+        Ball *ball = pool.create("wooden-ball", 16, 1.0f);
+        ball->place(range(rng), range(rng));
+        ball->vel = { range(rng), range(rng) };
+        ball->restAnchor = ball->position;
+        balls.push_back(ball);
+    }
+    std::shuffle(balls.begin(), balls.end(), rng);
+    BallStore store;
+    for (auto &ball : balls) store.add(ball);
+
+    std::vector<float> x(count), y(count), px(count), py(count), vx(count), vy(count), ax(count), ay(count);
+    std::vector<float> resistance(count, 0.85f), radius(count, 16), restX(count), restY(count);
+    for (int i = 0; i < count; i++) {
+        x[i] = px[i] = restX[i] = balls[i]->position.x;
+        y[i] = py[i] = restY[i] = balls[i]->position.y;
+        vx[i] = balls[i]->vel.x;
+        vy[i] = balls[i]->vel.y;
+    }
+    float gx = Vars::gravity.x * 60, gy = Vars::gravity.y * 60;
+
+    // Integration: BallStore packs the objects' state, integrates it and writes it back
+    double ns = Benchmark::time_kernel(count, [&] {
+        store.save_previous_positions();
+        store.gather();
+        store.integrate(FIXED_TIMESTEP, Vars::gravity);
+        store.scatter();
+    });
+    print_time("layout", "object_integrate", count, ns);
+    ns = Benchmark::time_kernel(count, [&] {
+        std::copy(x.begin(), x.end(), px.begin());
+        std::copy(y.begin(), y.end(), py.begin());
+        integrate_balls(x.data(), y.data(), vx.data(), vy.data(), ax.data(), ay.data(), resistance.data(), count,
+                        gx, gy, FIXED_TIMESTEP);
+    });
+    print_time("layout", "component_integrate", count, ns);
+
+    // Swept bounds, which the broad phase and every query start from
+    AABB all = { 0, 0, 0, 0 };
+    ns = Benchmark::time_kernel(count, [&] {
+        for (auto &ball : balls) {
+            AABB box = ball->bounds();
+            all.minX = std::min(all.minX, box.minX);
+            all.maxY = std::max(all.maxY, box.maxY);
+        }
+    });
+    print_time("layout", "object_bounds", count, ns);
+    ns = Benchmark::time_kernel(count, [&] {
+        for (int i = 0; i < count; i++) {
+            all.minX = std::min(all.minX, std::min(x[i], px[i]) - radius[i]);
+            all.maxY = std::max(all.maxY, std::max(y[i], py[i]) + radius[i]);
+        }
+    });
+    print_time("layout", "component_bounds", count, ns);
+
+    // The resting check of the sleep pass, with every other ball resting
+    for (int i = 0; i < count; i += 2) {
+        balls[i]->restAnchor = balls[i]->position;
+        restX[i] = x[i];
+        restY[i] = y[i];
+    }
+    int resting = 0;
+    ns = Benchmark::time_kernel(count, [&] {
+        resting = 0;
+        for (auto &ball : balls) resting += ball->position.dst2(ball->restAnchor) < 4.0f;
+    });
+    print_hits("layout", "object_rest", count, ns, resting);
+    ns = Benchmark::time_kernel(count, [&] {
+        resting = 0;
+        for (int i = 0; i < count; i++) {
+            float dx = x[i] - restX[i], dy = y[i] - restY[i];
+            resting += dx * dx + dy * dy < 4.0f;
+        }
+    });
+    print_hits("layout", "component_rest", count, ns, resting);
+    print_checksum("layout", count, all.minX + all.maxY);
+}
+
+// Candidate gathering: the spatial hash over moving balls and the tree over static shapes,
+// at a density where every ball has a few neighbours
+static void bench_broadphase(int count, std::mt19937 &rng) {
+    std::uniform_real_distribution<float> unit(0, 1);
+    float extent = 40.0f * sqrtf(count);
+    ObjectPool<Ball> balls;
+    ObjectPool<Rectangle> rectangles;
+    std::vector<Ball*> dynamic;
+    std::vector<WorldObject*> statics;
+    for (int i = 0; i < count; i++) {
+        Ball *ball = balls.create("wooden-ball", 16, 1.0f);
+        ball->place(extent * unit(rng), extent * unit(rng));
+        ball->index = i;
+        dynamic.push_back(ball);
+
+        Rectangle *rect = rectangles.create("wooden-plank", 40 + 160 * unit(rng), 20 + 60 * unit(rng), 90 * unit(rng) - 45);
+        rect->place(extent * unit(rng), extent * unit(rng));
+        rect->bake();
+        rect->index = i;
+        statics.push_back(rect);
+    }
+
+    SpatialHash hash(64, 64);
+    double ns = Benchmark::time_kernel(count, [&] {
+        hash.build(dynamic, count);
+    });
+    print_time("broadphase", "spatial_hash_build", count, ns);
+    std::vector<int> candidates;
+    long long found = 0;
+    ns = Benchmark::time_kernel(count, [&] {
+        found = 0;
+        for (auto &obj : dynamic) {
+            candidates.clear();
+            hash.query(obj->bounds(), candidates);
+            found += candidates.size();
+        }
+    });
+    print_hits("broadphase", "spatial_hash_query", count, ns, found);
+
+    StaticTree tree;
+    ns = Benchmark::time_kernel(count, [&] {
+        tree.build(statics);
+    });
+    print_time("broadphase", "static_tree_build", count, ns);
+    ns = Benchmark::time_kernel(count, [&] {
+        found = 0;
+        for (auto &obj : dynamic) {
+            candidates.clear();
+            tree.query(obj->bounds(), candidates);
+            found += candidates.size();
+        }
+    });
+    print_hits("broadphase", "static_tree_query", count, ns, found);
+}
+
+// Visibility pass and draw list of a generated scene, per frame
+static void bench_culling(int count, unsigned int seed) {
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    Benchmark::SceneConfig config;
+    config.balls = count;
+    config.lines = count / 20;
+    config.rectangles = count / 20;
+    config.seed = seed;
+    Benchmark::generate_scene(game, config);
+    game.update(FIXED_TIMESTEP);
+
+    RenderFrame frame;
+    double ns = Benchmark::time_kernel(1, [&] {
+        game.prepare_frame(frame);
+    });
+    print_hits("culling", "prepare_frame", count, ns, frame.items.size());
+}
+
+// Texture handle lookups by name, which every created object does, and sprite lookups by handle
+static void bench_assets(int count) {
+    std::vector<std::string> names(count);
+    for (int i = 0; i < count; i++) names[i] = "bench-texture-" + std::to_string(i);
+    Assets &assets = Assets::get();
+    for (auto &name : names) assets.intern(name.c_str());
+
+    long long sum = 0;
+    double ns = Benchmark::time_kernel(count, [&] {
+        for (auto &name : names) sum += assets.intern(name.c_str());
+    });
+    print_time("assets", "intern", count, ns);
+    std::vector<TextureHandle> handles(count);
+    for (int i = 0; i < count; i++) handles[i] = assets.intern(names[(i * 7919) % count].c_str());
+    ns = Benchmark::time_kernel(count, [&] {
+        auto lock = assets.lock_sprites();
+        for (auto handle : handles) sum += assets.sprite(handle)->source.w;
+    });
+    print_time("assets", "sprite", count, ns);
+    print_checksum("assets", count, (double) sum);
+}
+
+static void print_usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [--sizes N[,N...]] [--seed S] [--suites NAME[,NAME...]]\n"
+            "  --sizes   input sizes every suite runs at, defaults to 256,4096,65536\n"
+            "  --seed    seed of the random inputs, defaults to 1\n"
+            "  --suites  any of collision, contact, sweep, integration, layout, broadphase, culling,\n"
+            "            assets, vector and trig, defaults to all of them\n"
+            "Prints one JSON object per line: a header, then one line per case and size.\n",
+            program);
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+    std::vector<std::string> suites;
+    unsigned int seed = 1;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--sizes") && hasValue) {
+            for (char *size = strtok(argv[++i], ","); size != nullptr; size = strtok(nullptr, ",")) {
+                sizes.push_back(std::max(1, atoi(size)));
+            }
+        }
+        else if (!strcmp(argv[i], "--seed") && hasValue) seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--suites") && hasValue) {
+            for (char *suite = strtok(argv[++i], ","); suite != nullptr; suite = strtok(nullptr, ",")) {
+                suites.push_back(suite);
+            }
+        }
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (sizes.empty()) sizes = { 256, 4096, 65536 };
+    if (suites.empty()) suites = { "collision", "contact", "sweep", "integration", "layout", "broadphase", "culling", "assets", "vector", "trig" };
+
+    SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_TIMER) != 0)
+    {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return 1;
+    }
+    printf("{\"bench\": \"aluminium\", \"simd\": \"%s\", \"seed\": %u}\n", Benchmark::simd_name(), seed);
+    for (auto &suite : suites) {
+        for (int size : sizes) {
+            // Every suite and size gets the same inputs no matter what ran before
+            std::mt19937 rng(seed);
+            if (suite == "collision") bench_collision(size, rng);
+            else if (suite == "contact") bench_contact(size, rng);
+            else if (suite == "sweep") bench_sweep(size, rng);
+            else if (suite == "integration") bench_integration(size, rng);
+            else if (suite == "layout") bench_layout(size, rng);
+            else if (suite == "broadphase") bench_broadphase(size, rng);
+            else if (suite == "culling") bench_culling(size, seed);
+            else if (suite == "assets") bench_assets(size);
+            else if (suite == "vector") Benchmark::math(size);
+            else if (suite == "trig") Benchmark::trig(size);
+            else {
+                fprintf(stderr, "Bench Error: unknown suite %s\n", suite.c_str());
+                SDL_Quit();
+                return 1;
+            }
+            fflush(stdout);
+        }
+    }
+    SDL_Quit();
+    return 0;
+}
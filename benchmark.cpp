@@ -0,0 +1,328 @@
+#include "benchmark.h"
+
+namespace Benchmark {
+    void generate_scene(Aluminium &game, SceneConfig config) {
+        std::mt19937 rng(config.seed);
+        auto range = [&rng](float min, float max) {
+            return std::uniform_real_distribution<float>(min, max)(rng);
+        };
+        float halfWidth = std::max(5000.0f, (float) config.balls);
+        
+        game.add_rectangle("wooden-beam", -halfWidth, 0, halfWidth * 2, 40);
+        for (int i = 0; i < config.rectangles; i++) {
+            game.add_rectangle("wooden-plank", range(-halfWidth, halfWidth), range(-1500, -100),
+                               range(60, 250), range(30, 150), range(-45, 45));
+        }
+        for (int i = 0; i < config.lines; i++) {
+            float x = range(-halfWidth, halfWidth), y = range(-1500, -100);
+            game.add_line(x, y, x + range(80, 400), y + range(-150, 150), i % 2);
+        }
+        // The player first, then the extra balls
+        for (int i = 0; i <= config.balls; i++) {
+            bool wooden = i % 2;
+            game.add_ball(range(-halfWidth, halfWidth), range(-3000, -200),
+                          wooden ? "wooden-ball" : "aluminium-ball", 16, wooden ? 1.0f : 1.7f, i == 0);
+        }
+        for (int i = 0; i < config.ropes; i++) {
+            float x = range(-halfWidth, halfWidth), y = range(-2500, -600);
+            Vec2f to = { x + config.links * 20.0f, y + range(-100, 100) };
+            game.add_rope({ x, y }, to, config.links, "aluminium-ball", 8, 0.8f, 0.1f, i % 2 == 0, i % 4 == 1 ? 0.001f : -1);
+        }
+        game.bake();
+    }
+    
+    void churn(Aluminium &game, std::mt19937 &rng, int count) {
+        for (int i = 0; i < count; i++) {
+            int index = std::uniform_int_distribution<int>(0, game.object_count() - 1)(rng);
+            WorldObject *obj = game.object_at(index);
+            if (obj->type != SHAPE_BALL || obj == game.get_player()) continue;
+            
+            float x = obj->position.x;
+            game.despawn(obj);
+            game.add_ball(x, -3000, "wooden-ball", 16, 1.0f);
+        }
+    }
+    
+    void print_pool(const char *name, PoolStats stats, bool last) {
+        printf("\"%s\": {\"live\": %d, \"high_water\": %d, \"capacity\": %d, \"bytes\": %zu}%s",
+               name, stats.live, stats.highWater, stats.capacity, stats.bytesReserved, last ? "" : ", ");
+    }
+    
+    void run(Aluminium &game, const char *scene, int steps, SceneConfig config) {
+        std::mt19937 rng(config.seed);
+        Uint64 start = SDL_GetPerformanceCounter();
+        long long pairsTested = 0, pairsCollided = 0, sweptBalls = 0;
+        FrameTimes stepTimes(steps);
+        FrameBudget budget(config.budgetMs);
+        for (int i = 0; i < steps; i++) {
+            Uint64 stepStart = SDL_GetPerformanceCounter();
+            if (config.churn > 0) churn(game, rng, config.churn);
+            game.update(config.timestep);
+            float stepMs = Utils::seconds_since(stepStart) * 1000;
+            stepTimes.add(stepMs);
+            if (budget.add(stepMs)) game.set_quality(budget.quality());
+            
+            CollisionStats stats = game.collision_stats();
+            pairsTested += stats.pairsTested;
+            pairsCollided += stats.pairsCollided;
+            sweptBalls += stats.sweptBalls;
+        }
+        double seconds = Utils::seconds_since(start);
+        PhaseTimings &t = game.phase_timings();
+        double toMs = 1000.0 / std::max(1, t.steps);
+        
+        printf("{\"scene\": \"%s\", \"objects\": %d, \"balls\": %d, \"steps\": %d, "
+               "\"seconds\": %.6f, \"steps_per_sec\": %.2f, "
+               "\"phase_ms_per_step\": {\"integration\": %.6f, \"constraints\": %.6f, \"camera\": %.6f, \"broad_phase\": %.6f, \"narrow_phase\": %.6f}, "
+               "\"pairs_tested_per_step\": %.2f, \"pairs_collided_per_step\": %.2f, \"swept_balls_per_step\": %.2f, \"sleeping_balls\": %d, "
+               "\"constraints\": %d, ",
+               scene, game.object_count(), game.ball_count(), steps,
+               seconds, steps / std::max(seconds, 1e-9),
+               t.integration * toMs, t.constraints * toMs, t.camera * toMs, t.broadPhase * toMs, t.narrowPhase * toMs,
+               (double) pairsTested / std::max(1, steps), (double) pairsCollided / std::max(1, steps),
+               (double) sweptBalls / std::max(1, steps), game.collision_stats().sleepingBalls, game.constraint_count());
+        printf("\"step_ms\": {\"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f}, ",
+               stepTimes.percentile(0.5f), stepTimes.percentile(0.95f), stepTimes.percentile(0.99f), stepTimes.percentile(1.0f));
+        BudgetStats b = budget.get_stats();
+        printf("\"budget\": {\"budget_ms\": %.3f, \"level\": %d, \"average_ms\": %.4f, \"over_budget_steps\": %d, \"degradations\": %d, \"restorations\": %d}, ",
+               b.budgetMs, b.level, b.averageMs, b.overBudgetFrames, b.degradations, b.restorations);
+        
+        // Rollback cost, restoring the state just captured leaves the world unchanged
+        const int rounds = 100;
+        WorldSnapshot snapshot;
+        Uint64 snapshotStart = SDL_GetPerformanceCounter();
+        for (int i = 0; i < rounds; i++) game.capture(snapshot);
+        double captureSeconds = Utils::seconds_since(snapshotStart);
+        snapshotStart = SDL_GetPerformanceCounter();
+        for (int i = 0; i < rounds; i++) game.restore(snapshot);
+        double restoreSeconds = Utils::seconds_since(snapshotStart);
+        printf("\"snapshot\": {\"bytes\": %zu, \"capture_us\": %.2f, \"restore_us\": %.2f}, ",
+               snapshot.bodies.size() * sizeof(BodyState) + snapshot.constraints.size() * sizeof(ConstraintState) +
+               snapshot.contacts.size() * sizeof(ContactState), captureSeconds * 1e6 / rounds, restoreSeconds * 1e6 / rounds);
+        
+        StreamStats streaming = game.stream_stats();
+        printf("\"streaming\": {\"active_chunks\": %d, \"streamed_shapes\": %d, \"chunk_loads\": %d, \"chunk_unloads\": %d}, ",
+               streaming.activeChunks, streaming.streamedShapes, streaming.chunkLoads, streaming.chunkUnloads);
+        
+        MemoryStats memory = game.memory_stats();
+        printf("\"memory\": {");
+        print_pool("balls", memory.balls, false);
+        print_pool("lines", memory.lines, false);
+        print_pool("rectangles", memory.rectangles, false);
+        print_pool("pendulums", memory.pendulums, true);
+        printf("}}\n");
+        fflush(stdout);
+    }
+    
+    // Vec2f as it was before it got value semantics, kept as the baseline for --bench-math
+    struct LegacyVec2f {
+        float x, y;
+        float dot_prod(LegacyVec2f &other) {
+            return x * other.x + y * other.y;
+        }
+        float len() {
+            return sqrt(x*x + y*y);
+        }
+        float dst2(LegacyVec2f &other) {
+            float dx = x - other.x;
+            float dy = y - other.y;
+            
+            return dx * dx + dy * dy;
+        }
+        void multiply(float scalar) {
+            x *= scalar;
+            y *= scalar;
+        }
+        void norm() {
+            multiply(1 / len());
+        }
+        LegacyVec2f rotate(float angle) {
+            float mx = x;
+            float my = y;
+            
+            x = mx * cos(angle) - my * sin(angle);
+            y = mx * sin(angle) + my * cos(angle);
+            
+            return *this;
+        }
+    };
+    
+    const char *simd_name() {
+#if defined(__AVX2__)
+        return "avx2";
+#elif defined(__SSE2__)
+        return "sse2";
+#else
+        return "scalar";
+#endif
+    }
+    
+    void math(int count) {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> range(-1000, 1000);
+        std::vector<LegacyVec2f> legacyA(count), legacyB(count);
+        std::vector<Vec2f> a(count), b(count);
+        std::vector<float> ax(count), ay(count), bx(count), by(count);
+        for (int i = 0; i < count; i++) {
+            a[i] = { range(rng), range(rng) };
+            b[i] = { range(rng), range(rng) };
+            legacyA[i] = { a[i].x, a[i].y };
+            legacyB[i] = { b[i].x, b[i].y };
+            ax[i] = a[i].x; ay[i] = a[i].y;
+            bx[i] = b[i].x; by[i] = b[i].y;
+        }
+        std::vector<float> out(count), expected(count);
+        std::vector<float> rx, ry;
+        std::vector<Vec2f> r;
+        std::vector<LegacyVec2f> legacyR;
+        float angle = 0.01f;
+        double sink = 0;
+        
+        printf("{\"bench\": \"vec_math\", \"count\": %d, \"simd\": \"%s\", \"kernels\": {", count, simd_name());
+        auto report = [&](const char *name, double legacy, double current, double batch, float maxDiff, bool last) {
+            printf("\"%s\": {\"legacy_ns\": %.3f, \"vec2f_ns\": %.3f, \"batch_ns\": %.3f, \"max_diff\": %g}%s",
+                   name, legacy, current, batch, maxDiff, last ? "" : ", ");
+        };
+        auto max_diff = [&](const float *x, const float *y, const std::vector<Vec2f> &v) {
+            float diff = 0;
+            for (int i = 0; i < count; i++) diff = std::max({ diff, fabsf(x[i] - v[i].x), fabsf(y[i] - v[i].y) });
+            return diff;
+        };
+        
+        // Every round rotates the same input so the values stay comparable
+        double legacy = time_kernel(count, [&] {
+            legacyR = legacyA;
+            for (auto &v : legacyR) v.rotate(angle);
+            sink += legacyR[0].x;
+        });
+        double current = time_kernel(count, [&] {
+            r = a;
+            for (auto &v : r) v.rotate(angle);
+            sink += r[0].x;
+        });
+        double batch = time_kernel(count, [&] {
+            rx = ax; ry = ay;
+            VecBatch::rotate_n(rx.data(), ry.data(), count, angle);
+            sink += rx[0];
+        });
+        report("rotate", legacy, current, batch, max_diff(rx.data(), ry.data(), r), false);
+        
+        legacy = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) out[i] = legacyA[i].dst2(legacyB[i]);
+            sink += out[0];
+        });
+        current = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) expected[i] = a[i].dst2(b[i]);
+            sink += expected[0];
+        });
+        batch = time_kernel(count, [&] {
+            VecBatch::dst2_n(ax.data(), ay.data(), bx.data(), by.data(), count, out.data());
+            sink += out[0];
+        });
+        float diff = 0;
+        for (int i = 0; i < count; i++) diff = std::max(diff, fabsf(out[i] - expected[i]));
+        report("dst2", legacy, current, batch, diff, false);
+        
+        legacy = time_kernel(count, [&] {
+            legacyR = legacyA;
+            for (auto &v : legacyR) v.norm();
+            sink += legacyR[0].x;
+        });
+        current = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) r[i] = a[i].normalized();
+            sink += r[0].x;
+        });
+        batch = time_kernel(count, [&] {
+            rx = ax; ry = ay;
+            VecBatch::normalize_n(rx.data(), ry.data(), count);
+            sink += rx[0];
+        });
+        report("normalize", legacy, current, batch, max_diff(rx.data(), ry.data(), r), false);
+        
+        legacy = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) out[i] = legacyA[i].dot_prod(legacyB[i]);
+            sink += out[0];
+        });
+        current = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) expected[i] = a[i].dot_prod(b[i]);
+            sink += expected[0];
+        });
+        batch = time_kernel(count, [&] {
+            VecBatch::dot_n(ax.data(), ay.data(), bx.data(), by.data(), count, out.data());
+            sink += out[0];
+        });
+        diff = 0;
+        for (int i = 0; i < count; i++) diff = std::max(diff, fabsf(out[i] - expected[i]));
+        report("dot", legacy, current, batch, diff, true);
+        
+        // Printing the sink keeps the timed loops from being optimized away
+        printf("}, \"checksum\": %g}\n", sink);
+        fflush(stdout);
+    }
+    
+    // Max error against double precision libm and throughput of one Trig tier, as a JSON member
+    template <Trig::Accuracy A>
+    void trig_tier(const char *name, const std::vector<float> &angles, const std::vector<float> &ys,
+                   const std::vector<float> &xs, double &sink, bool last) {
+        int count = angles.size();
+        std::vector<float> s(count), c(count), batchS(count), batchC(count), a(count), batchA(count);
+        
+        double scalar = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) Trig::sincos<A>(angles[i], s[i], c[i]);
+            sink += s[0];
+        });
+        double batch = time_kernel(count, [&] {
+            Trig::sincos_n<A>(angles.data(), batchS.data(), batchC.data(), count);
+            sink += batchS[0];
+        });
+        double error = 0, diff = 0;
+        for (int i = 0; i < count; i++) {
+            error = std::max({ error, fabs(s[i] - std::sin((double) angles[i])), fabs(c[i] - std::cos((double) angles[i])) });
+            diff = std::max({ diff, (double) fabsf(s[i] - batchS[i]), (double) fabsf(c[i] - batchC[i]) });
+        }
+        printf("\"%s\": {\"sincos\": {\"max_error\": %g, \"scalar_ns\": %.3f, \"batch_ns\": %.3f, \"batch_diff\": %g}, ",
+               name, error, scalar, batch, diff);
+        
+        scalar = time_kernel(count, [&] {
+            for (int i = 0; i < count; i++) a[i] = Trig::atan2<A>(ys[i], xs[i]);
+            sink += a[0];
+        });
+        batch = time_kernel(count, [&] {
+            Trig::atan2_n<A>(ys.data(), xs.data(), batchA.data(), count);
+            sink += batchA[0];
+        });
+        error = 0;
+        diff = 0;
+        for (int i = 0; i < count; i++) {
+            error = std::max(error, fabs(a[i] - std::atan2((double) ys[i], (double) xs[i])));
+            diff = std::max(diff, (double) fabsf(a[i] - batchA[i]));
+        }
+        printf("\"atan2\": {\"max_error\": %g, \"scalar_ns\": %.3f, \"batch_ns\": %.3f, \"batch_diff\": %g}}%s",
+               error, scalar, batch, diff, last ? "" : ", ");
+    }
+    
+    void trig(int count) {
+        std::mt19937 rng(1);
+        std::uniform_real_distribution<float> angle(-1000, 1000), coordinate(-1000, 1000);
+        std::vector<float> angles(count), ys(count), xs(count);
+        for (int i = 0; i < count; i++) {
+            angles[i] = angle(rng);
+            ys[i] = coordinate(rng);
+            xs[i] = coordinate(rng);
+        }
+        // Exact axes and zeros, where quadrant handling goes wrong first
+        const float special[][2] = { { 0, 0 }, { 0, -1 }, { 1, 0 }, { -1, 0 }, { 0, 1 }, { -0.0f, -1 }, { 1, 1 }, { -1, -1 } };
+        for (int i = 0; i < count && i < 8; i++) {
+            ys[i] = special[i][0];
+            xs[i] = special[i][1];
+        }
+        
+        double sink = 0;
+        printf("{\"bench\": \"trig\", \"count\": %d, \"simd\": \"%s\", \"tiers\": {", count, simd_name());
+        trig_tier<Trig::TRIG_FAST>("fast", angles, ys, xs, sink, false);
+        trig_tier<Trig::TRIG_BALANCED>("balanced", angles, ys, xs, sink, false);
+        trig_tier<Trig::TRIG_PRECISE>("precise", angles, ys, xs, sink, true);
+        printf("}, \"checksum\": %g}\n", sink);
+        fflush(stdout);
+    }
+};
@@ -0,0 +1,57 @@
+// Scene generation and timing reports shared by the game's headless mode and aluminium-bench
+#ifndef ALUMINIUM_BENCHMARK_H
+#define ALUMINIUM_BENCHMARK_H
+
+#include "aluminium.h"
+
+namespace Benchmark {
+    struct SceneConfig {
+        // Balls besides the player, who is always spawned
+        int balls = 0;
+        int lines = 0;
+        int rectangles = 0;
+        // Ropes hung above the scene, alternating between bridges and chains
+        int ropes = 0;
+        int links = 32;
+        unsigned int seed = 1;
+        // Balls despawned and spawned again every step
+        int churn = 0;
+        // Seconds simulated per step
+        float timestep = FIXED_TIMESTEP;
+        // Level file streamed instead of the default level
+        const char *level = nullptr;
+        // Milliseconds a step may take before the quality drops, 0 keeps full quality
+        float budgetMs = 0;
+    };    
+    // Builds a level in the spirit of Aluminium::load, scaled up: one long beam as the
+    // floor, rotated planks and sloped lines above it, and balls dropped on top of everything
+    void generate_scene(Aluminium &game, SceneConfig config);
+    // Replaces random balls with fresh ones dropped from above
+    void churn(Aluminium &game, std::mt19937 &rng, int count);
+    // Steps the simulation without rendering and prints a JSON report to stdout
+    void run(Aluminium &game, const char *scene, int steps, SceneConfig config);
+    
+    // Instruction set the batch kernels were built for
+    const char *simd_name();
+    // Nanoseconds per element of the fastest of a few rounds
+    template <typename F>
+    double time_kernel(int count, F kernel) {
+        const int rounds = 7, repeats = 20;
+        double best = 1e30;
+        for (int r = 0; r < rounds; r++) {
+            Uint64 start = SDL_GetPerformanceCounter();
+            for (int i = 0; i < repeats; i++) kernel();
+            best = std::min(best, Utils::seconds_since(start));
+        }
+        return best * 1e9 / ((double) count * repeats);
+    }
+    
+    // Times the legacy Vec2f, the current Vec2f and the VecBatch kernels on the same data,
+    // and checks the batch results against Vec2f. Prints a JSON report to stdout.
+    void math(int count);
+    // Compares every Trig tier with libm on random angles within a few hundred turns, which
+    // covers a spinning pendulum, and random points for atan2. Prints a JSON report to stdout.
+    void trig(int count);
+};
+
+#endif
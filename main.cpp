@@ -1,850 +1,263 @@
-#include <SDL2/SDL_hints.h>
-#include <SDL2/SDL_render.h>
-#include <SDL2/SDL_timer.h>
-#include <map>
-#include <vector>
-#include <cmath>
-
-#include <SDL2/SDL.h>
-#include <SDL2/SDL_image.h>
-
-const int SCREEN_WIDTH = 640;
-const int SCREEN_HEIGHT = 640;
-
-SDL_Renderer *renderer = nullptr;
+#include "aluminium.h"
+#include "benchmark.h"
+
+// Steps the game at the fixed timestep on its own thread, publishing a RenderFrame after every
+// batch of steps, so waiting on VSync doesn't hold physics back and slow steps don't stall drawing.
+// Events polled on the main thread are queued for it. The quality is only changed from this thread.
+class SimulationThread {
+    struct QueuedEvent {
+        SDL_Event event;
+        SDL_Point pointer;
+    };
+    Aluminium &game;
+    TripleBuffer<RenderFrame> frames;
+    std::mutex eventMutex;
+    std::vector<QueuedEvent> events, handling;
+    std::atomic<bool> running{ true };
+    std::thread thread;
+    FrameBudget budget;
+    // Drawing time of the main thread's latest frame
+    std::atomic<float> renderMs{ 0 };
+    std::mutex statsMutex;
+    BudgetStats stats;
+    
+    void loop() {
+        PROFILE_THREAD("simulation");
+        Uint64 frequency = SDL_GetPerformanceFrequency();
+        Uint64 then = 0, now = SDL_GetPerformanceCounter();
+        float accumulator = 0.0f;
+        while (running) {
+            {
+                std::lock_guard<std::mutex> lock(eventMutex);
+                handling.swap(events);
+            }
+            for (auto &e : handling) game.handle_event(e.event, e.pointer);
+            handling.clear();
+            
+            then = now;
+            now = SDL_GetPerformanceCounter();
+            accumulator += (float) (now - then) / frequency;
+            
+            // Same catch-up rule as drawing and stepping on one thread
+            int steps = 0;
+            Uint64 stepStart = SDL_GetPerformanceCounter();
+            while (accumulator >= FIXED_TIMESTEP && steps < MAX_CATCH_UP_STEPS) {
+                game.update(FIXED_TIMESTEP);
+                accumulator -= FIXED_TIMESTEP;
+                steps++;
+            }
+            if (accumulator >= FIXED_TIMESTEP) {
+                accumulator = fmod(accumulator, FIXED_TIMESTEP);
+            }
+            
+            if (steps > 0) {
+                RenderFrame &frame = frames.back_buffer();
+                game.prepare_frame(frame);
+                frame.stepTime = now - (Uint64) (accumulator * frequency);
+                frames.publish();
+                
+                // Stepping and drawing run side by side, so the slower of the two sets the pace
+                float stepMs = Utils::seconds_since(stepStart) * 1000 / steps;
+                if (budget.add(std::max(stepMs, renderMs.load()))) game.set_quality(budget.quality());
+                std::lock_guard<std::mutex> lock(statsMutex);
+                stats = budget.get_stats();
+            }
+            // Sleep until the next step is due
+            float wait = FIXED_TIMESTEP - accumulator;
+            if (wait > 0) std::this_thread::sleep_for(std::chrono::duration<float>(wait));
+        }
+    }
+    public:
+        // The game is stepped only by this thread until the object is destroyed
+        SimulationThread(Aluminium &game, float budgetMs) : game(game), budget(budgetMs) {
+            game.set_uploads_textures(false);
+            thread = std::thread(&SimulationThread::loop, this);
+        }
+        ~SimulationThread() {
+            running = false;
+            thread.join();
+            game.set_uploads_textures(true);
+        }
+        void post(SDL_Event event, SDL_Point pointer) {
+            std::lock_guard<std::mutex> lock(eventMutex);
+            events.push_back({ event, pointer });
+        }
+        void report_render(float ms) {
+            renderMs = ms;
+        }
+        BudgetStats budget_stats() {
+            std::lock_guard<std::mutex> lock(statsMutex);
+            return stats;
+        }
+        // Newest frame, and how far the simulation clock has moved past it in steps
+        const RenderFrame &latest(float &alpha) {
+            const RenderFrame &frame = frames.latest();
+            alpha = 0;
+            if (frame.stepTime != 0) {
+                Uint64 now = SDL_GetPerformanceCounter();
+                alpha = now > frame.stepTime ? (float) (now - frame.stepTime) / SDL_GetPerformanceFrequency() / FIXED_TIMESTEP : 0;
+                alpha = std::min(alpha, 1.0f);
+            }
+            return frame;
+        }
+};
 
-// Cxxdroid functions
-static SDL_Texture *load_texture(const char *path)
+static void print_usage(const char *program)
 {
-    SDL_Surface *img = IMG_Load(path);
-    if (img == NULL)
-    {
-        fprintf(stderr, "IMG_Load Error: %s\n", IMG_GetError());
-        return NULL;
-    }
-    SDL_Texture *texture = SDL_CreateTextureFromSurface(renderer, img);
-    SDL_FreeSurface(img);
-    if (texture == NULL)
-    {
-        fprintf(stderr, "SDL_CreateTextureFromSurface Error: %s\n", SDL_GetError());
-        return NULL;
-    }
-    return texture;
+    fprintf(stderr,
+            "Usage: %s [--headless STEPS] [--balls N[,N...]] [--lines N] [--rectangles N] [--seed S] [--threads N] [--churn N] [--timestep SECONDS]\n"
+            "          [--ropes N] [--links N] [--level FILE] [--write-level FILE] [--profile FILE] [--bench-math N] [--bench-trig N]\n"
+            "          [--inline-simulation] [--budget MS]\n"
+            "  --headless   run STEPS fixed physics steps without a window and print JSON timings\n"
+            "  --balls      generate a benchmark scene instead of the default level, with the player\n"
+            "               and N more balls, a comma separated list runs one scene per ball count\n"
+            "  --threads    threads used for contact resolution, defaults to the core count\n"
+            "  --churn      balls despawned and respawned every step\n"
+            "  --ropes      hang N ropes of --links balls each (default 32) over generated scenes\n"
+            "  --timestep   seconds simulated per step, defaults to 1/60\n"
+            "  --level      stream the level from FILE instead of building the default one\n"
+            "  --write-level  save the default level, or the first generated scene, to FILE and exit\n"
+            "  --profile    record scoped timings and write them to FILE as a Chrome trace on exit,\n"
+            "               the window title shows frame time percentiles meanwhile\n"
+            "  --bench-math time Vec2f and the batch vector kernels over N vectors and exit\n"
+            "  --bench-trig measure error against libm and throughput of every Trig tier over N inputs and exit\n"
+            "  --inline-simulation  step the simulation on the render thread instead of its own\n"
+            "  --budget     milliseconds a frame may take before solver passes, offscreen balls and rope\n"
+            "               drawing are cut back, 0 keeps full quality. Defaults to one fixed step in the\n"
+            "               window and to 0 with --headless, where it applies to every step\n",
+            program);
 }
 
-namespace Projection {
-    float cameraX, cameraY;
-    void world_to_screen(float &outX, float &outY)
+// Returns the process exit code
+static int run_headless(int steps, std::vector<int> &ballCounts, Benchmark::SceneConfig config, int threads)
+{
+    SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_TIMER) != 0)
     {
-        // SCREEN_WIDTH/HEIGHT are the relative positions
-        outX = (int)(SCREEN_WIDTH / 2 + outX - cameraX); 
-        outY = (int)(SCREEN_HEIGHT / 2 + outY - cameraY); 
-    }
-    void adjust_camera(float relativeX, float relativeY) {
-        cameraX = relativeX;
-        cameraY = relativeY;
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return 1;
     }
-};
-
-namespace Utils {
-    // Insert utilities here...
-    float clamp(float &value, float min, float max)
-    {
-        if (value < min) value = min;
-        else if (value > max) value = max;
+    if (config.level != nullptr) {
+        Aluminium game;
+        game.init();
+        if (threads > 0) game.set_thread_count(threads);
+        if (!game.load_level(config.level)) return 1;
+        Benchmark::run(game, "level", steps, config);
+    } else if (ballCounts.empty()) {
+        Aluminium game;
+        game.init();
+        if (threads > 0) game.set_thread_count(threads);
+        game.load();
+        Benchmark::run(game, "default", steps, config);
+    }
+    for (auto &count : ballCounts) {
+        Aluminium game;
+        game.init();
+        if (threads > 0) game.set_thread_count(threads);
         
-        return value;
-    }
-    float another_clamp(float &value, float min, float max)
-    {
-        return std::max(min, std::min(max, value));
+        config.balls = count;
+        Benchmark::generate_scene(game, config);
+        Benchmark::run(game, "generated", steps, config);
     }
-    float interp(float from, float to, float progress) {
-        return progress * (to - from);
-    }
-    SDL_Rect get_viewport_rect()
-    {
-        return { 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT};
-    }
-    bool rectangle_collide(const SDL_Rect *r1, const SDL_Rect *r2)
-    {
-        SDL_bool intersect = SDL_HasIntersection(r1, r2);
-        return intersect == SDL_TRUE ? true : false;
-    }
-    float radians(float degrees) {
-        return degrees / 180 * M_PI;
-    }
-    float degrees(float radians) {
-        return radians * 180 / M_PI;
-    }
-    float f_sin(float a) {
-        return sin(radians(a));
-    }
-    float f_cos(float a) {
-        return cos(radians(a));
-    }
-};
+    SDL_Quit();
+    return 0;
+}
 
-struct Vec2f {
-    float x, y;
-    void set_zero() {
-        x = 0;
-        y = 0;
-    }
-    Vec2f from(Vec2f &other) {
-        Vec2f result = { other.x, other.y };
-        return result;
-    }
-    float dot_prod(Vec2f &other) {
-        return x * other.x + y * other.y;
-    }
-    float cross_prod(Vec2f &other) {
-        return x * other.y - y * other.x;
-    }
-    Vec2f perpendicular(int side) {
-        int j = side >= 0 ? 1 : -1;
-        
-        Vec2f result; 
-        result.x = j * y;
-        result.y = -j * x;
-        
-        return result;
-    }  
-    float len() {
-        return sqrt(x*x + y*y);
-    }
-    float len2() {
-        return x*x + y*y;
-    }
-    float dst(Vec2f &other) {
-        float dx = x - other.x;
-        float dy = y - other.y;
-        
-        return sqrt(dx * dx + dy * dy);
-    }
-    float dst2(Vec2f &other) {
-        float dx = x - other.x;
-        float dy = y - other.y;
-        
-        return dx * dx + dy * dy;
-    }
-    void multiply(float scalar) {
-        x *= scalar;
-        y *= scalar;
-    }
-    void norm() {
-        multiply(1 / len());
-    }
-    Vec2f subtract(Vec2f &other) {
-        x -= other.x;
-        y -= other.y;
-        
-        return *this;
-    }
-    Vec2f add(float ox, float oy) {
-        x += ox;
-        y += oy;
-        
-        return *this;
-    }
-    Vec2f interpolate(Vec2f &other, float progress) {
-        x = x + (other.x - x) * progress;
-        y = y + (other.y - y) * progress;
-        
-        return *this;
+// Returns the process exit code
+static int write_level(const char *path, std::vector<int> &ballCounts, Benchmark::SceneConfig config)
+{
+    if (SDL_Init(SDL_INIT_TIMER) != 0)
+    {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return 1;
     }
-    Vec2f rotate(float angle) {
-        float mx = x;
-        float my = y;
-        
-        x = mx * cos(angle) - my * sin(angle);
-        y = mx * sin(angle) + my * cos(angle);
-        
-        return *this;
+    Aluminium game;
+    game.init();
+    if (ballCounts.empty()) {
+        game.load();
+    } else {
+        config.balls = ballCounts[0];
+        Benchmark::generate_scene(game, config);
     }
-};
+    bool written = game.export_level(path, LEVEL_CHUNK_SIZE);
+    SDL_Quit();
+    return written ? 0 : 1;
+}
 
-enum LoadStages{
-    TEXTURES
-};
+// Returns whether the trace was written
+static bool write_profile([[maybe_unused]] const char *path)
+{
+#if defined(ALUMINIUM_NO_PROFILE)
+    return false;
+#else
+    Profiler::set_enabled(false);
+    return Profiler::export_trace(path);
+#endif
+}
 
-class Assets {
-    std::map<const char*, SDL_Texture*> textures;
-    public:
-        static Assets &get()
-        {
-            static Assets ins;
-            return ins;
-        }
-        
-        SDL_Texture *find_texture(const char *location) {
-            return textures[location];
+int main(int argc, char *argv[])
+{
+    int headlessSteps = 0, threads = 0, benchMath = 0, benchTrig = 0;
+    float budgetMs = -1;
+    const char *writeLevel = nullptr, *profile = nullptr;
+    bool inlineSimulation = false;
+    std::vector<int> ballCounts;
+    Benchmark::SceneConfig config;
+    for (int i = 1; i < argc; i++) {
+        bool hasValue = i + 1 < argc;
+        if (!strcmp(argv[i], "--headless") && hasValue) headlessSteps = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--balls") && hasValue) {
+            for (char *count = strtok(argv[++i], ","); count != nullptr; count = strtok(nullptr, ",")) {
+                ballCounts.push_back(atoi(count));
+            }
         }
-        void add_texture(const char *location, const char *name) {
-            SDL_Texture *t = load_texture(name);
-            textures[location] = t;
+        else if (!strcmp(argv[i], "--lines") && hasValue) config.lines = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rectangles") && hasValue) config.rectangles = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && hasValue) config.seed = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--threads") && hasValue) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--churn") && hasValue) config.churn = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--ropes") && hasValue) config.ropes = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--links") && hasValue) config.links = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--timestep") && hasValue) config.timestep = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--level") && hasValue) config.level = argv[++i];
+        else if (!strcmp(argv[i], "--write-level") && hasValue) writeLevel = argv[++i];
+        else if (!strcmp(argv[i], "--profile") && hasValue) profile = argv[++i];
+        else if (!strcmp(argv[i], "--bench-math") && hasValue) benchMath = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bench-trig") && hasValue) benchTrig = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--inline-simulation")) inlineSimulation = true;
+        else if (!strcmp(argv[i], "--budget") && hasValue) budgetMs = atof(argv[++i]);
+        else {
+            print_usage(argv[0]);
+            return 1;
         }
-        void load(LoadStages stage);
-    private:
-        Assets() {}
-        ~Assets() {}
-    public:
-        Assets(Assets const&) = delete;
-        void operator = (Assets const&) = delete;    
-};
-void Assets::load(LoadStages stage) {
-    switch (stage) {
-         case TEXTURES:
-              add_texture("aluminium-ball", "aluminium-ball.png");
-              add_texture("wooden-ball", "wooden-ball.png");
-              add_texture("wooden-plank", "wooden-plank.png");
-              add_texture("wooden-beam", "wooden-beam.png");
-              break;
-    }
-};
-
-namespace Vars {
-    Vec2f gravity = { 0.0f, 9.8f };
-    // Measured in radians
-    float gravity_angle() {
-        return atan2(-gravity.y, gravity.x);
-    }
-};
-
-struct CollisionData {
-    // This doesn't have to be exactly inside the object to collide with
-    Vec2f intersection_point;
-    bool collided;
-};
-
-struct Circle {
-    Vec2f position;
-    float radius;
-};
-
-
-namespace Draw {
-    // Insert drawing methods here...
-    void color(float r, float g, float b) {
-        float ar = r * 255;
-        float ag = g * 255; 
-        float ab = b * 255;
-        
-        Utils::clamp(ar, 0, 255);
-        Utils::clamp(ag, 0, 255);
-        Utils::clamp(ab, 0, 255); 
-        SDL_SetRenderDrawColor(renderer, (int) ar, (int) ag, (int) ab, 255);
-    };
-    void texture(SDL_Texture *tex, int x, int y, int w, int h)
-    { 
-        int sw = (int) w;
-        int sh = (int) h;
-        SDL_Rect cRect = {(int) x - sw / 2, (int) y - sh / 2, sw, sh};
-        SDL_Rect v = Utils::get_viewport_rect();
-        if (Utils::rectangle_collide(&cRect, &v))
-            SDL_RenderCopy(renderer, tex, NULL, &cRect);
     }
-    void texture_uncentered(SDL_Texture *tex, int x, int y, int width, int height)
-    { 
-        int sw = (int) width;
-        int sh = (int) height;
-        SDL_Rect cRect = {x, y, sw, sh};
-        SDL_Rect v = Utils::get_viewport_rect();
-        if (Utils::rectangle_collide(&cRect, &v))
-            SDL_RenderCopy(renderer, tex, NULL, &cRect);
+    if (benchMath > 0) {
+        Benchmark::math(benchMath);
+        return 0;
     }
-    void rotated_texture(SDL_Texture *tex, int x, int y, int width, int height, float angle)
-    {
-        int sw = (int) width;
-        int sh = (int) height;
-        SDL_Rect cRect = {x, y, sw, sh};
-        SDL_RenderCopyEx(renderer, tex, NULL, &cRect, angle, NULL, SDL_FLIP_NONE);
+    if (benchTrig > 0) {
+        Benchmark::trig(benchTrig);
+        return 0;
     }
-    void rect_fill_uncentered(int x, int y, int w, int h)
-    {
-        SDL_Rect dest = { x, y, w, h };
-        SDL_RenderFillRect(renderer, &dest);
-    } 
-    void rect_fill(int x, int y, int w, int h)
-    {
-        SDL_Rect dest = { x - w / 2, y - h / 2, w, h };
-        if (x >= 0 && x < SCREEN_WIDTH && y >= 0 && y < SCREEN_HEIGHT) 
-            SDL_RenderFillRect(renderer, &dest);
-    }
-    void line(int x1, int y1, int x2, int y2)
-    {
-        SDL_RenderDrawLine(renderer, x1, y1, x2, y2);
+    if (writeLevel != nullptr) {
+        return write_level(writeLevel, ballCounts, config);
     }
-};
-
-class WorldObject {
-    public:
-        float resistance;
-        float mass;
-  
-        Vec2f position;
-        Vec2f vel, acceleration;
-    
-        WorldObject *colliding = nullptr;
-        int index = 0;
-        const char *name;
-        WorldObject(float mass) {
-            this->mass = mass;
-            this->resistance = 0.85f;
-            
-            // Reset position, velocity, acceleration
-            reset();
-        }
-        void place(float x, float y) {
-             position.x = x;
-             position.y = y;
-        }
-        void moveX(float x) {
-             position.x += x;
-        }
-        void moveY(float y) {
-             position.y += y;
-        }
-        void reset() {
-             position.set_zero();
-             vel.set_zero();
-             acceleration.set_zero();
-        } 
-        virtual CollisionData collision(WorldObject *object) { return CollisionData{}; }
-        virtual void update(float timeTook) {}
-        virtual void render() {}
-};
-
-class Ball : public WorldObject {
-    SDL_Texture *ballTexture;
-    public: 
-        float radius;
-        Ball(const char *spriteName, float radius, float mass) : WorldObject(mass) {
-            this->radius = radius;
-            this->ballTexture = Assets::get().find_texture(spriteName);
-            this->name = "ball";
-        }
-        SDL_Texture *get_texture() {
-            return ballTexture;
-        }   
-        void jump(float force, WorldObject *o);
-        void update(float timeTook) override;
-        void render() override;
-    
-    CollisionData collision(WorldObject *object) override;
-};
-class Line : public WorldObject {
-    public:
-        Vec2f endPosition;
-        Vec2f gradient, normal;
-        int side = 0;  
-        Line(Vec2f v1, Vec2f v2) : WorldObject(4.0f) {
-            this->position = v1;
-            this->endPosition = v2;
-            
-            this->name = "line";
-        }
-        void update(float timeTook) override;
-        void render() override;
-};
-
-class Rectangle : public WorldObject {
-    SDL_Texture *rectangleTexture;
-    public:
-        float width;
-        float height;
-        float angle;
-        Rectangle(const char *textureName, float width, float height, float angle) : WorldObject(4.0f) {
-            this->width = width;
-            this->height = height;
-            this->angle = Utils::radians(angle);
-            this->rectangleTexture = Assets::get().find_texture(textureName);
-            
-            this->name = "rectangle";
-        }
-        void render() override;
-};
-void Rectangle::render() {
-     float ox = position.x, oy = position.y;
-     Projection::world_to_screen(ox, oy);
-     
-     Draw::rotated_texture(rectangleTexture, ox, oy, width, height, Utils::degrees(angle));
-};
-
-void Ball::jump(float force, WorldObject *o) {
-     const char *oName = o->name;
-     
-     if (oName == "line") {
-          Vec2f normal = ((Line*) o)->normal;
-          vel.x += normal.x * vel.y;
-          vel.y += -force + normal.y;
-     }
-     if (oName == "rectangle") {
-          Rectangle *r = (Rectangle*) o;
-          Vec2f p = collision(r).intersection_point;
-          Vec2f m = r->position;
-                                      
-          // Retransform the intersection point
-          m.add(r->width / 2, r->height / 2);
-          p.subtract(m);
-          p.rotate(r->angle);
-          p.add(m.x, m.y);
-              
-          Vec2f normal = p;
-          normal.subtract(position);
-          normal.norm();
-            
-          vel.x += normal.x * vel.y;
-          vel.y += -force + normal.y;
-     }
-     if (oName == "ball") {
-          float dx = o->position.x - position.x;
-          float dy = o->position.y - position.y;
-               
-          float angle = atan2(dy, dx);
-          float px = cos(angle) * force;
-          float py = sin(angle) * force;
-               
-          vel.x -= px;
-          vel.y -= py;
-               
-          o->vel.x += px;
-          o->vel.y += py;   
-     }
-};
-void Ball::update(float timeTook) {
-    // Ball kinematics
-    acceleration.x = -vel.x * resistance + Vars::gravity.x * 60;
-    acceleration.y = -vel.y * resistance + Vars::gravity.y * 60;
-    
-    vel.x += acceleration.x * timeTook;
-    vel.y += acceleration.y * timeTook;
-    
-    position.x += vel.x * timeTook;
-    position.y += vel.y * timeTook;
-    
-    if (position.y >= radius + 50000) {
-        place(position.x, -400);
+    if (profile != nullptr) {
+#if defined(ALUMINIUM_NO_PROFILE)
+        fprintf(stderr, "Profiler Error: built with ALUMINIUM_NO_PROFILE\n");
+        return 1;
+#else
+        PROFILE_THREAD("main");
+        Profiler::set_enabled(true);
+#endif
     }
-    if (fabs(vel.len2()) < 0.01f) {
-        vel.set_zero();
+    if (headlessSteps > 0) {
+        config.budgetMs = std::max(0.0f, budgetMs);
+        int code = run_headless(headlessSteps, ballCounts, config, threads);
+        if (code == 0 && profile != nullptr && !write_profile(profile)) code = 1;
+        return code;
     }
-};
-CollisionData Ball::collision(WorldObject *object) {
-     CollisionData data;
-     
-     const char *oName = object->name;
-     // Colliding with a line
-     if (oName == "line") {
-          Vec2f v1 = object->position;
-          Vec2f v2 = ((Line*) object)->endPosition;
-               
-          float dx = v2.x - v1.x;
-          float dy = v2.y - v1.y;
-          float dx2 = position.x - v1.x;
-          float dy2 = position.y - v1.y;
-               
-          Vec2f vec1 = { dx, dy };
-          Vec2f vec2 = { dx2, dy2 };
-    
-          float len = vec1.len2();
-          float dotProduct = vec1.dot_prod(vec2);
-          float alpha = Utils::another_clamp(dotProduct, 0, len) / len;
-    
-          Vec2f interp_point = v1;
-          interp_point.interpolate(v2, alpha);
-     
-          float dst = interp_point.dst2(position);
-          bool collided = dst <= radius * radius;
-               
-          data.intersection_point = interp_point;
-          data.collided = collided;
-     }
-     // Colliding with a rectangle
-     if (oName == "rectangle") {
-          Rectangle *dest = (Rectangle*) object;
-          Vec2f centerRectangle = dest->position;
-          centerRectangle.add(dest->width / 2, dest->height / 2);
-          Vec2f centerBall = position;
-          Vec2f intersection;
-          
-          Vec2f gradient = { centerBall.x - centerRectangle.x, centerBall.y - centerRectangle.y };
-          Vec2f r = gradient;
-          r.rotate(-dest->angle);
-          r.add(centerRectangle.x, centerRectangle.y);
-          
-          float dx = dest->position.x;
-          float dy = dest->position.y;
-          if (r.x < dx) {
-              intersection.x = dx;
-          } else if (r.x > (dx + dest->width)) {
-              intersection.x = dx + dest->width;
-          }
-          else intersection.x = r.x;
-          
-          if (r.y < dy) {
-              intersection.y = dy;
-          } else if (r.y > (dy + dest->height)) {
-              intersection.y = dy + dest->height;
-          }
-          else intersection.y = r.y;
-           
-          Vec2f m = { r.x - intersection.x, r.y - intersection.y };
-          data.collided = m.len2() <= radius * radius;
-          data.intersection_point = intersection;
-     }
-     // Colliding with another ball   
-     if (oName == "ball") {
-          float dst = position.dst2(object->position);
-          float r = ((Ball*) object)->radius;
-          bool intersecting = dst <= (radius + r) * (radius + r);
-    
-          Vec2f n = { 0, 0 };
-          data.intersection_point = n;
-          data.collided = intersecting;
-     }
-     
-     return data;
-};
-
-void Ball::render() {
-    float ox = position.x, oy = position.y;
-    Projection::world_to_screen(ox, oy);
-    
-    Draw::texture(ballTexture, ox, oy, radius * 2, radius * 2);
-};
-
-
-void Line::update(float timeTook) {
-    gradient.x = endPosition.x - position.x;
-    gradient.y = endPosition.y - position.y;
-    normal = gradient.perpendicular(side);
-    normal.norm();
-};
-
-void Line::render() {
-    float dx = position.x, dy = position.y;
-    float dx2 = endPosition.x, dy2 = endPosition.y;
-    
-    Projection::world_to_screen(dx, dy);
-    Projection::world_to_screen(dx2, dy2);
     
-    Draw::line(dx, dy, dx2, dy2);
-};
-
-class Pendulum : public WorldObject {
-    public:
-       float angle;
-       float angularAcceleration;
-       float angularVelocity;
-       
-       float length;
-       float damping;
-       
-       Ball *knob;
-       Vec2f knobPosition, drawnKnobPosition;
-       Pendulum(float length, Ball *knob) : WorldObject(knob->mass) {
-           this->angle = M_PI;
-           this->angularVelocity = 0;
-           this->angularAcceleration = 0;
-           this->length = length;
-           this->damping = 0.995f;
-           
-           this->knob = knob;
-           
-           this->name = "pendulum";
-           this->knobPosition = position;
-       }
-       void add(std::vector<WorldObject*> &vec) {
-           knob->place(knobPosition.x, knobPosition.y);
-           knob->index = vec.size();
-           vec.push_back(knob);
-       }
-       void place(Vec2f pos) {
-           float x = pos.x + cos(angle) * length;
-           float y = pos.y + sin(angle) * length;
-           
-           this->knob->place(x, y);
-           this->knobPosition.x = x;
-           this->knobPosition.y = y;
-       }
-       void apply(Vec2f vel) {
-           Vec2f p = vel;
-           Vec2f gradient = { knobPosition.x - position.x, knobPosition.y - position.y };
-           float cr = gradient.cross_prod(p);
-           float len = gradient.len2();
-            
-           angularVelocity = (cr / len);
-       }
-       void update(float timeTook) override;
-       void render() override;
-};
-void Pendulum::update(float timeTook) {
-     knob->update(timeTook);
-     knobPosition = knob->position;
-     
-     float l = length;
-     if (knob->colliding != nullptr) {
-         apply(knob->colliding->vel);
-         knob->colliding = nullptr;
-     } else {  
-         angularAcceleration = (Vars::gravity.y / l) * sin(angle);
-         angularVelocity += angularAcceleration;
-         angularVelocity *= damping;
-         angle += angularVelocity * timeTook;
-     }
-       
-     float a = angle - Utils::radians(90);
-     float px = position.x + cos(a) * l;
-     float py = position.y + sin(a) * l;
-     
-     Vec2f gradient = { position.x - knobPosition.x, position.y - knobPosition.y };
-     Vec2f nor = gradient.perpendicular(-1);
-     nor.norm();
-     nor.multiply(knob->mass * length * sin(angle));
-     
-     knob->vel = nor;
-     knob->position.x = px;
-     knob->position.y = py; 
-       
-     drawnKnobPosition = knob->position;
-};
-void Pendulum::render() {
-     float dx = position.x, dy = position.y;
-     float ox = drawnKnobPosition.x, oy = drawnKnobPosition.y;
-     //float mx = knob->vel.x + ox, my = knob->vel.y + oy;
-     
-     Projection::world_to_screen(dx, dy);
-     Projection::world_to_screen(ox, oy);
-     //Projection::world_to_screen(mx, my);
-     
-     Draw::line(dx, dy, ox, oy);
-     // Layering issue fix
-     knob->render();
-     // Debug drawing
-     //Draw::line(ox, oy, mx, my);
-};
-
-class Game
-{
-   public:
-      const char *displayName = "";
-      virtual ~Game() {};
-      virtual void init() {};
-      virtual void load() {};
-    
-      virtual void handle_event(SDL_Event ev) {};
-
-      virtual void update(float timeTook) {};
-};
-
-class Aluminium : public Game {
-    Ball *player;
-    std::vector<WorldObject*> objects;
-    public:
-       void init() override {
-           displayName = "Aluminium";
-       } 
-       void load() override {
-           Assets::get().load(TEXTURES);
-           
-           add_ball(600, -300, "aluminium-ball", 16, 1.7, true);
-           
-           add_pendulum(new Ball("aluminium-ball", 16, 10), 1100, -110, 70);
-           add_ball(800, -1000, "wooden-ball", 16, 1.0);
-            
-           add_rectangle("wooden-beam", 0, 0, 10000, 40);
-               
-           add_rectangle("wooden-plank", 500, -150, 150, 150);
-           add_rectangle("wooden-plank", 750, -150, 200, 40, -30);
-           
-       }
-    
-       void handle_event(SDL_Event ev) override {
-           int cx = 0, cy = 0;
-           SDL_GetMouseState(&cx, &cy);
-           
-           float f = cx > SCREEN_WIDTH / 2 ? 4 : -4;
-           player->vel.x += f;
-           
-           if (player->colliding != nullptr) {
-               if (cy < SCREEN_WIDTH / 2) {  
-                   player->jump(300, player->colliding);
-                   player->colliding = nullptr;
-               }
-           }
-       }
-       void update(float timeTook) override { 
-           for (auto &obj : objects) {
-                obj->update(timeTook);
-           }
-           Projection::adjust_camera(player->position.x, player->position.y);
-           
-           // Collision detection
-           for (auto &obj : objects) {
-                const char *name = obj->name;
-                if (name == "ball") {
-                     Ball *ball = (Ball*) obj;
-                     
-                     for (auto &other : objects) {
-                          if (ball->index != other->index) {
-                              if (other->name == "line") {
-                                  Line *line = (Line*) other;
-                                  CollisionData dat = ball->collision(other);
-                                  Vec2f intersection = dat.intersection_point;   
-                                  if (dat.collided) {
-                                      ball->colliding = line;
-                                      
-                                      // Calculate distance
-                                      float dst = ball->position.dst(intersection);
-                                      float d = ball->radius - dst;
-                    
-                                      ball->moveX(-d * (intersection.x - ball->position.x) / dst);
-                                      ball->moveY(-d * (intersection.y - ball->position.y) / dst);
-                    
-                                      // Elastic collision
-                                      Vec2f nor = line->normal;
-                    
-                                      float dotP = nor.dot_prod(ball->vel);
-                                      float j = 2 * dotP / (ball->mass + line->mass);
-                    
-                                      ball->vel.x = ball->vel.x - j * nor.x * line->mass;
-                                      ball->vel.y = ball->vel.y - j * nor.y * line->mass;
-                                  }
-                              }
-                              if (other->name == "rectangle") {
-                                  Rectangle *r = (Rectangle*) other;
-                                  CollisionData dat = ball->collision(r);
-                                  if (dat.collided) {
-                                      ball->colliding = r;
-                                      Vec2f p = dat.intersection_point;
-                                      Vec2f m = r->position;
-                                      
-                                      // Retransform the intersection point
-                                      m.add(r->width / 2, r->height / 2);
-                                      p.subtract(m);
-                                      p.rotate(r->angle);
-                                      p.add(m.x, m.y);
-                                      
-                                      // Static collision
-                                      float dst = ball->position.dst(p);
-                                      float d = ball->radius - dst;
-                    
-                                      ball->moveX(-d * (p.x - ball->position.x) / dst);
-                                      ball->moveY(-d * (p.y - ball->position.y) / dst);
-                    
-                                      // Elastic collision
-                                      Vec2f nor = p;
-                                      nor.subtract(ball->position);
-                                      nor.norm();
-                                      
-                                      float dotP = nor.dot_prod(ball->vel);
-                                      float j = 2 * dotP / (ball->mass + r->mass);
-                    
-                                      ball->vel.x = ball->vel.x - j * nor.x * r->mass;
-                                      ball->vel.y = ball->vel.y - j * nor.y * r->mass;
-                                  }
-                              }
-                              if (other->name == "ball") {
-                                  Ball *ball2 = (Ball*) other;
-                                  CollisionData dat = ball->collision(ball2);
-                                  if (dat.collided) {
-                                      ball->colliding = ball2;
-                                      
-                                      // Calculate distance again
-                                      float dst = ball->position.dst(ball2->position);
-                                      float d = dst - ball->radius - ball2->radius;
-                                      d *= 0.5;
-                               
-                                      float bx1 = ball->position.x;
-                                      float by1 = ball->position.y;
-                                
-                                      float bx2 = ball2->position.x;
-                                      float by2 = ball2->position.y;
-                                
-                                      ball->moveX(-d * (bx1 - bx2) / dst);
-                                      ball->moveY(-d * (by1 - by2) / dst);
-                               
-                                      ball2->moveX(d * (bx1 - bx2) / dst);
-                                      ball2->moveY(d * (by1 - by2) / dst);
-                               
-                                      // Elastic collision
-                                      Vec2f gradient = { ball2->position.x - ball->position.x, ball2->position.y - ball->position.y };
-                                      Vec2f gradientVelocity = { ball->vel.x - ball2->vel.x, ball->vel.y - ball2->vel.y };  
-                                      Vec2f nor = gradient;
-                                      nor.norm();
-                               
-                                      float dotP = nor.dot_prod(gradientVelocity);
-                                      float j = 2 * dotP / (ball->mass + ball2->mass);
-                    
-                                      ball->vel.x = ball->vel.x - j * nor.x * ball2->mass;
-                                      ball->vel.y = ball->vel.y - j * nor.y * ball2->mass;
-                               
-                                      ball2->vel.x = ball2->vel.x + j * nor.x * ball->mass;
-                                      ball2->vel.y = ball2->vel.y + j * nor.y * ball->mass;
-                                  }
-                              }
-                          }
-                     }
-                }
-           }
-           // Rendering
-           Draw::color(0.1, 0.1, 0.85);
-           Draw::rect_fill_uncentered(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);
-           Draw::color(1.0, 1.0, 1.0);
-           
-           for (auto &obj : objects) {
-                obj->render();
-           }
-       }
-       void add_line(float x1, float y1, float x2, float y2) {
-           add_line(x1, y1, x2, y2, 0);
-       }
-       void add_line(float x1, float y1, float x2, float y2, int pointing) {
-           Line *line = new Line({x1, y1}, {x2, y2});
-           line->side = pointing;
-           
-           line->index = objects.size();
-           objects.push_back(line);
-       }
-       
-       void add_ball(float x, float y, const char *spriteName, float radius, float mass) {
-           add_ball(x, y, spriteName, radius, mass, false);
-       }
-       void add_ball(float x, float y, const char *spriteName, float radius, float mass, bool isPlayer) {
-           Ball *ball = new Ball(spriteName, radius, mass);
-           ball->place(x, y);
-           if (isPlayer) {
-               player = ball;
-           }
-           ball->index = objects.size();
-           objects.push_back(ball);
-       }
-       void add_pendulum(Ball *ball, float x, float y, float length) {
-           Pendulum *p = new Pendulum(length, ball);
-           p->position.x = x;
-           p->position.y = y;
-           p->place({x, y});
-           p->add(objects);
-           
-           p->index = objects.size();
-           objects.push_back(p);
-       }
-       void add_rectangle(const char *spriteName, float centerX, float centerY, float width, float height, float angle) {
-           Rectangle *r = new Rectangle(spriteName, width, height, angle);
-           r->place(centerX, centerY);
-           
-           r->index = objects.size();
-           objects.push_back(r);
-       }
-       void add_rectangle(const char *spriteName, float centerX, float centerY, float width, float height) {
-           add_rectangle(spriteName, centerX, centerY, width, height, 0);
-       }
-};
-
-
-int main()
-{
 	if (SDL_Init(SDL_INIT_EVERYTHING) != 0)
     {
         fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
@@ -852,6 +265,7 @@ int main()
     }
     Aluminium game;
     game.init();
+    if (threads > 0) game.set_thread_count(threads);
     
     SDL_Window *window = SDL_CreateWindow(game.displayName, SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
     if (window == NULL)
@@ -868,14 +282,49 @@ int main()
     }
     SDL_RenderSetVSync(renderer, 1);
 
-    game.load();
+    // Decode textures in the background while showing a progress bar
+    Assets::get().begin_load(TEXTURES);
+    float progress = 0.0f;
+    SDL_Event e;
+    while ((progress = Assets::get().poll_load()) < 1.0f)
+    {
+        while (SDL_PollEvent(&e))
+        {
+            if (e.type == SDL_QUIT) {
+                Assets::get().cancel_load();
+                SDL_DestroyWindow(window);
+                SDL_Quit();
+                return 0;
+            }
+        }
+        Draw::color(0, 0, 0);
+        SDL_RenderClear(renderer);
+        Draw::color(1, 1, 1);
+        Draw::rect_fill_uncentered(SCREEN_WIDTH / 4, SCREEN_HEIGHT / 2 - 8, (int) (SCREEN_WIDTH / 2 * progress), 16);
+        SDL_RenderPresent(renderer);
+    }
+    if (config.level == nullptr) {
+        game.load();
+    } else if (!game.load_level(config.level)) {
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 1;
+    }
     
-    float then = 0.0f, delta = 0.0f;
-    float now = SDL_GetPerformanceCounter();
+    // Kept as integer ticks, float counters lose precision on long runs
+    Uint64 then = 0, now = SDL_GetPerformanceCounter(), titleShown = now;
+    float delta = 0.0f, accumulator = 0.0f;
+    FrameTimes frameTimes(600);
+    // Frames are due once per fixed step unless told otherwise
+    if (budgetMs < 0) budgetMs = FIXED_TIMESTEP * 1000;
+    FrameBudget budget(budgetMs);
+    // Steps the game from here on, unless it runs inline on this thread
+    std::unique_ptr<SimulationThread> simulation;
+    if (!inlineSimulation) simulation.reset(new SimulationThread(game, budgetMs));
     bool disabled = false;
-    SDL_Event e;
     while (!disabled)
     {
+        PROFILE_SCOPE("frame");
         // Code cited from lazyfoo.net
         while (SDL_PollEvent(&e))
         {
@@ -884,22 +333,70 @@ int main()
                 case SDL_QUIT:
                     disabled = true;
                     break;
+                // Render target contents are lost, the static layer draws its chunks again
+                case SDL_RENDER_TARGETS_RESET:
+                case SDL_RENDER_DEVICE_RESET:
+                    Draw::reset_static_layer();
+                    break;
             }
-            game.handle_event(e);
+            SDL_Point pointer;
+            SDL_GetMouseState(&pointer.x, &pointer.y);
+            if (simulation != nullptr) simulation->post(e, pointer);
+            else game.handle_event(e, pointer);
         }
         then = now;
         now = SDL_GetPerformanceCounter();
-        delta = (now - then) * 1 / SDL_GetPerformanceFrequency();
+        delta = (float) (now - then) / SDL_GetPerformanceFrequency();
+        frameTimes.add(delta * 1000);
+        
+        // Live frame time summary, refreshed every second
+        if (profile != nullptr && now - titleShown >= SDL_GetPerformanceFrequency()) {
+            BudgetStats b = simulation != nullptr ? simulation->budget_stats() : budget.get_stats();
+            char title[160];
+            snprintf(title, sizeof(title), "%s - frame ms p50 %.2f p95 %.2f p99 %.2f max %.2f - quality level %d", game.displayName,
+                     frameTimes.percentile(0.5f), frameTimes.percentile(0.95f), frameTimes.percentile(0.99f), frameTimes.percentile(1.0f), b.level);
+            SDL_SetWindowTitle(window, title);
+            titleShown = now;
+        }
         
         Draw::color(0, 0, 0);
         SDL_RenderClear(renderer);
-
         Draw::color(1, 1, 1);
-        game.update(delta);
+        
+        if (simulation != nullptr) {
+            // Streamed textures are uploaded here, the simulation thread only requests them
+            Uint64 renderStart = SDL_GetPerformanceCounter();
+            Assets::get().update_streaming();
+            
+            float alpha;
+            const RenderFrame &frame = simulation->latest(alpha);
+            auto lock = Assets::get().lock_sprites();
+            frame.draw(alpha);
+            simulation->report_render(Utils::seconds_since(renderStart) * 1000);
+        } else {
+            // Fixed physics steps, catching up on at most MAX_CATCH_UP_STEPS per frame
+            Uint64 frameStart = SDL_GetPerformanceCounter();
+            accumulator += delta;
+            int steps = 0;
+            while (accumulator >= FIXED_TIMESTEP && steps < MAX_CATCH_UP_STEPS) {
+                game.update(FIXED_TIMESTEP);
+                accumulator -= FIXED_TIMESTEP;
+                steps++;
+            }
+            if (accumulator >= FIXED_TIMESTEP) {
+                accumulator = fmod(accumulator, FIXED_TIMESTEP);
+            }
+            game.render(accumulator / FIXED_TIMESTEP);
+            // Waiting on VSync in the present isn't work, so it isn't counted
+            if (budget.add(Utils::seconds_since(frameStart) * 1000)) game.set_quality(budget.quality());
+        }
 
+        PROFILE_SCOPE("present");
         SDL_RenderPresent(renderer);
     }
+    simulation.reset();
     SDL_DestroyWindow(window);
     SDL_Quit();
+    if (profile != nullptr && !write_profile(profile)) return 1;
     return 0;
 }
@@ -0,0 +1,273 @@
+// Regression tests of the simulation core, run headless by ctest.
+// Every test builds its own small world and prints what went wrong to stderr.
+#include "aluminium.h"
+#include "benchmark.h"
+
+#define EXPECT(condition) \
+    do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+            return false; \
+        } \
+    } while (0)
+
+// A ball falling out of the world comes back from above without stopping at
+// whatever lies between the depth it fell to and where it respawns
+static bool respawn_over_geometry()
+{
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    game.add_rectangle("wooden-plank", -100, 1000, 400, 40);
+    Ball *ball = game.add_ball(-100, Ball::FALL_DEPTH - 10, "wooden-ball", 16, 1.0f);
+    game.bake();
+    ball->vel = { 0, 3000 };
+
+    game.update(FIXED_TIMESTEP);
+    EXPECT(ball->position.y == Ball::RESPAWN_Y);
+    EXPECT(ball->previousPosition.x == ball->position.x && ball->previousPosition.y == ball->position.y);
+    EXPECT(ball->vel.y > 0);
+
+    // And it falls back onto the plank from above, rather than being caught below it
+    for (int i = 0; i < 600; i++) game.update(FIXED_TIMESTEP);
+    EXPECT(ball->position.y < 1000);
+    return true;
+}
+
+// Right after a restore a ball is drawn where it is, not streaking from where it was
+static bool restore_draws_without_streak()
+{
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    Ball *ball = game.add_ball(0, 0, "wooden-ball", 16, 1.0f);
+    ball->vel = { 3000, 0 };
+    game.update(FIXED_TIMESTEP);
+    WorldSnapshot snapshot;
+    game.capture(snapshot);
+    Vec2f captured = ball->position;
+    for (int i = 0; i < 10; i++) game.update(FIXED_TIMESTEP);
+
+    game.restore(snapshot);
+    std::vector<DrawItem> items;
+    ball->draw(items);
+    EXPECT(items.size() == 1);
+    EXPECT(items[0].from.x == captured.x && items[0].from.y == captured.y);
+    EXPECT(items[0].to.x == captured.x && items[0].to.y == captured.y);
+    return true;
+}
+
+// Generated scenes always have a player, --balls only adds to it
+static bool generated_scene_has_player()
+{
+    for (int balls : { 0, 3 }) {
+        Aluminium game;
+        game.init();
+        game.set_thread_count(1);
+        Benchmark::SceneConfig config;
+        config.balls = balls;
+        Benchmark::generate_scene(game, config);
+        EXPECT(game.get_player() != nullptr);
+        EXPECT(game.ball_count() == balls + 1);
+    }
+    return true;
+}
+
+// Removing what a sleeping stack rests on wakes the whole stack
+static bool despawn_wakes_resting_balls()
+{
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    Rectangle *plank = game.add_rectangle("wooden-plank", 0, 0, 400, 40);
+    Ball *bottom = game.add_ball(0, -40, "wooden-ball", 16, 1.0f);
+    Ball *top = game.add_ball(0, -80, "wooden-ball", 16, 1.0f);
+    game.bake();
+    for (int i = 0; i < 300; i++) game.update(FIXED_TIMESTEP);
+    EXPECT(bottom->sleeping && top->sleeping);
+
+    game.despawn(plank);
+    EXPECT(!bottom->sleeping && !top->sleeping);
+    float before = top->position.y;
+    for (int i = 0; i < 30; i++) game.update(FIXED_TIMESTEP);
+    EXPECT(top->position.y > before + 10);
+    return true;
+}
+
+// Corrupt snapshot files are rejected without allocating for counts they can't hold
+// or handing out sprite handles that were never interned
+static bool snapshot_rejects_corrupt_files()
+{
+    const char *path = "tests-snapshot.bin";
+    Aluminium game;
+    game.init();
+    game.add_ball(0, 0, "wooden-ball", 16, 1.0f);
+    WorldSnapshot snapshot, loaded;
+    game.capture(snapshot);
+    EXPECT(snapshot.save(path) && loaded.load(path));
+
+    WorldSnapshot::Header header = { { 'A', 'L', 'S', 'N' }, WorldSnapshot::VERSION, 0x7fffffff, 0, 0, -1, {}, {}, {} };
+    FILE *file = fopen(path, "wb");
+    EXPECT(file != NULL);
+    fwrite(&header, sizeof(header), 1, file);
+    fclose(file);
+    EXPECT(!loaded.load(path));
+
+    snapshot.bodies[0].ball.sprite = Assets::get().handle_count();
+    EXPECT(snapshot.save(path) && !loaded.load(path));
+    snapshot.bodies[0].ball.sprite = Assets::get().intern("wooden-ball");
+    snapshot.bodies[0].ball.sleeping = 2;
+    EXPECT(snapshot.save(path) && !loaded.load(path));
+    snapshot.bodies[0].ball.sleeping = 0;
+    snapshot.bodies[0].type = SHAPE_COUNT;
+    EXPECT(snapshot.save(path) && !loaded.load(path));
+    remove(path);
+    return true;
+}
+
+// A snapshot that fails to load keeps what it held before
+static bool failed_load_keeps_snapshot()
+{
+    const char *path = "tests-snapshot.bin";
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    Ball *first = game.add_ball(0, 0, "wooden-ball", 16, 1.0f, true);
+    game.add_ball(100, 0, "wooden-ball", 16, 1.0f);
+    WorldSnapshot snapshot, corrupt;
+    game.capture(snapshot);
+    game.capture(corrupt);
+    corrupt.bodies.pop_back();
+    corrupt.bodies[0].ball.sprite = -1;
+    corrupt.player = -1;
+    EXPECT(corrupt.save(path) && !snapshot.load(path));
+    remove(path);
+
+    EXPECT(snapshot.bodies.size() == 2 && snapshot.player == 0);
+    EXPECT(snapshot.bodies[0].ball.sprite == first->get_sprite());
+    first->place(500, 500);
+    game.restore(snapshot);
+    EXPECT(game.get_player()->position.x == 0 && game.get_player()->position.y == 0);
+    return true;
+}
+
+// A level ball streamed in after a capture spawns again once its chunk comes back after
+// restoring to before it was there
+static bool restore_respawns_streamed_balls()
+{
+    const char *path = "tests-level.bin";
+    {
+        Aluminium source;
+        source.init();
+        source.add_ball(0, 0, "aluminium-ball", 16, 1.7f, true);
+        source.add_ball(20000, 0, "wooden-ball", 16, 1.0f);
+        EXPECT(source.export_level(path, LEVEL_CHUNK_SIZE));
+    }
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    EXPECT(game.load_level(path));
+    EXPECT(game.ball_count() == 1);
+    WorldSnapshot snapshot;
+    game.capture(snapshot);
+
+    auto visit_far_ball = [&game]() {
+        game.get_player()->place(20000, -100);
+        for (int i = 0; i < 3; i++) game.update(FIXED_TIMESTEP);
+        return game.ball_count();
+    };
+    EXPECT(visit_far_ball() == 2);
+    game.restore(snapshot);
+    EXPECT(game.ball_count() == 1);
+    EXPECT(visit_far_ball() == 2);
+    remove(path);
+    return true;
+}
+
+// Static chunks are drawn into their textures once, and again only when what's in them changes
+static bool static_layer_reuses_chunks()
+{
+    SDL_InitSubSystem(SDL_INIT_VIDEO);
+    SDL_Window *window = SDL_CreateWindow("tests", 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, SDL_WINDOW_HIDDEN);
+    EXPECT(window != NULL);
+    renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE | SDL_RENDERER_TARGETTEXTURE);
+    EXPECT(renderer != NULL);
+    Assets::get().load(TEXTURES);
+
+    Aluminium game;
+    game.init();
+    game.set_thread_count(1);
+    game.add_rectangle("wooden-beam", 0, 0, 2000, 40);
+    game.add_line(-300, -200, 300, -100);
+    game.bake();
+    auto draw = [&game]() {
+        RenderFrame frame;
+        game.prepare_frame(frame);
+        frame.draw(1.0f);
+        return Draw::static_layer_stats();
+    };
+    StaticLayerStats first = draw(), second = draw();
+    EXPECT(first.chunksShown > 0 && first.chunksShown <= 9);
+    EXPECT(first.chunksRendered == first.chunksShown);
+    EXPECT(second.chunksShown == first.chunksShown && second.chunksRendered == 0);
+    EXPECT(second.cachedChunks == first.chunksShown);
+    EXPECT(second.bytes == (size_t) second.cachedChunks * StaticLayer::CHUNK_SIZE * StaticLayer::CHUNK_SIZE * 4);
+
+    // A plank in the middle of the screen only touches the chunks around the origin
+    game.add_rectangle("wooden-plank", 10, -60, 20, 20);
+    game.bake();
+    StaticLayerStats changed = draw();
+    EXPECT(changed.chunksRendered > 0 && changed.chunksRendered < changed.chunksShown);
+
+    Draw::reset_static_layer();
+    EXPECT(Draw::static_layer_stats().cachedChunks == 0);
+    SDL_DestroyRenderer(renderer);
+    renderer = nullptr;
+    SDL_DestroyWindow(window);
+    return true;
+}
+
+struct Test {
+    const char *name;
+    bool (*run)();
+};
+static const Test TESTS[] = {
+    { "respawn_over_geometry", respawn_over_geometry },
+    { "restore_draws_without_streak", restore_draws_without_streak },
+    { "generated_scene_has_player", generated_scene_has_player },
+    { "despawn_wakes_resting_balls", despawn_wakes_resting_balls },
+    { "snapshot_rejects_corrupt_files", snapshot_rejects_corrupt_files },
+    { "failed_load_keeps_snapshot", failed_load_keeps_snapshot },
+    { "restore_respawns_streamed_balls", restore_respawns_streamed_balls },
+    { "static_layer_reuses_chunks", static_layer_reuses_chunks },
+};
+
+int main(int argc, char *argv[])
+{
+    SDL_SetHint(SDL_HINT_VIDEODRIVER, "dummy");
+    if (SDL_Init(SDL_INIT_TIMER) != 0)
+    {
+        fprintf(stderr, "SDL_Init Error: %s\n", SDL_GetError());
+        return 1;
+    }
+    // Runs the named tests, or all of them
+    int failed = 0, ran = 0;
+    for (auto &test : TESTS) {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            if (!strcmp(argv[i], test.name)) selected = true;
+        }
+        if (!selected) continue;
+
+        bool passed = test.run();
+        printf("%s %s\n", passed ? "pass" : "FAIL", test.name);
+        failed += !passed;
+        ran++;
+    }
+    SDL_Quit();
+    if (ran == 0) {
+        fprintf(stderr, "Tests Error: no test matches\n");
+        return 1;
+    }
+    return failed > 0;
+}